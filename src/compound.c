@@ -64,6 +64,11 @@ uz_t compound_s_get_size( const compound_s* o )
     return o ? o->size : 0;
 }
 
+const envelope_s* compound_s_get_envelope( const compound_s* o )
+{
+    return o->envelope;
+}
+
 void compound_s_set_envelope( compound_s* o, const envelope_s* envelope )
 {
     if( o->envelope ) envelope_s_discard( o->envelope );
@@ -298,6 +303,43 @@ f3_t compound_s_ray_trans_hit( const compound_s* o, const ray_s* ray, trans_data
     return min_a;
 }
 
+void compound_s_ray_group_occlusion( const compound_s* o, const ray_s* ray, const f3_t* length, bl_t* occluded, vc_t* occluder, uz_t size )
+{
+    assert( size <= COMPOUND_GROUP_SIZE );
+    bl_t skip[ COMPOUND_GROUP_SIZE ];
+    bl_t active = false;
+    for( uz_t j = 0; j < size; j++ )
+    {
+        skip[ j ] = occluded[ j ] || ( o->envelope && !envelope_s_ray_hits( o->envelope, &ray[ j ] ) );
+        active = active || !skip[ j ];
+    }
+    if( !active ) return;
+
+    for( uz_t i = 0; i < o->size; i++ )
+    {
+        aware_t* element = o->data[ i ];
+        if( *element == TYPEOF_compound_s )
+        {
+            bl_t flags[ COMPOUND_GROUP_SIZE ];
+            for( uz_t j = 0; j < size; j++ ) flags[ j ] = skip[ j ] || occluded[ j ];
+            compound_s_ray_group_occlusion( ( compound_s* )element, ray, length, flags, occluder, size );
+            for( uz_t j = 0; j < size; j++ ) occluded[ j ] = occluded[ j ] || ( flags[ j ] && !skip[ j ] );
+        }
+        else
+        {
+            for( uz_t j = 0; j < size; j++ )
+            {
+                if( skip[ j ] || occluded[ j ] ) continue;
+                if( obj_ray_hit( element, &ray[ j ], NULL ) <= length[ j ] )
+                {
+                    occluded[ j ] = true;
+                    if( occluder ) occluder[ j ] = element;
+                }
+            }
+        }
+    }
+}
+
 uz_t compound_s_side_count( const compound_s* o, v3d_s pos, s2_t side )
 {
     uz_t count = 0;
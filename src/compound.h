@@ -40,6 +40,9 @@ BCORE_DECLARE_FUNCTIONS_OBJ( trans_data_s )
 /**********************************************************************************************************************/
 /// compound_s (array of objects)
 
+/// maximum number of rays in a group (compound_s_ray_group_occlusion)
+#define COMPOUND_GROUP_SIZE 64
+
 typedef struct compound_s compound_s;
 
 BCORE_DECLARE_FUNCTIONS_OBJ( compound_s )
@@ -48,6 +51,7 @@ uz_t           compound_s_get_size(   const compound_s* o );
 const aware_t* compound_s_get_object( const compound_s* o, uz_t index );
 
 /// envelopes
+const envelope_s* compound_s_get_envelope( const compound_s* o ); // NULL: no envelope
 void compound_s_set_envelope( compound_s* o, const envelope_s* envelope );
 void compound_s_set_auto_envelope( compound_s* o );
 
@@ -62,6 +66,13 @@ void compound_s_push(   compound_s* o, sr_s object );
 f3_t compound_s_ray_hit( const compound_s* o, const ray_s* r, v3d_s* p_nor, vc_t* hit_obj );
 f3_t compound_s_ray_trans_hit( const compound_s* o, const ray_s* r, trans_data_s* trans );
 
+/** Occlusion test for a group of rays (e.g. shadow rays): occluded[ i ] is set true when ray i hits an object
+ *  at an offset <= length[ i ]. Rays already flagged occluded are not tested. size <= COMPOUND_GROUP_SIZE
+ *  Traversal is object-major: each object is tested against all rays of the group before the next object.
+ *  occluder (optional; may be NULL): receives the occluding object of each newly occluded ray.
+ */
+void compound_s_ray_group_occlusion( const compound_s* o, const ray_s* ray, const f3_t* length, bl_t* occluded, vc_t* occluder, uz_t size );
+
 /// counts number of objects where pos is on the side 'side'
 uz_t compound_s_side_count( const compound_s* o, v3d_s pos, s2_t side );
 
@@ -127,12 +127,53 @@ static inline bl_t sphere_intersects_half_sphere( v3d_s pos, f3_t r, const ray_s
     f3_t d2 = v3d_s_sqr( d );
     if( d2 > f3_sqr( r + ray_radius ) ) return false; // spheres do not intersect at all
     f3_t dp = v3d_s_mlv( d, ray->d );
-    if( dp > 0 ) return true; // half-sphere is oriented towards pos -> must intersect
-    v3d_s dn = v3d_s_of_length( v3d_s_sub( d, v3d_s_mlf( ray->d, dp ) ), ray_radius );
-    f3_t r_sqr = f3_sqr( r );
-    if( v3d_s_sqr( v3d_s_sub( d, dn ) ) < r_sqr ) return true;
-    if( v3d_s_sqr( v3d_s_add( d, dn ) ) < r_sqr ) return true;
-    return false;
+    if( dp >= 0 ) return true; // half-sphere is oriented towards pos -> must intersect
+    if( -dp > r ) return false; // sphere is entirely behind the base plane
+
+    // distance of pos to the base disk
+    f3_t lateral = sqrt( f3_max( 0, d2 - dp * dp ) ) - ray_radius;
+    lateral = f3_max( lateral, 0 );
+    return dp * dp + lateral * lateral <= f3_sqr( r );
+}
+
+/**********************************************************************************************************************/
+
+/** GGX microfacet distribution (Walter et al. 2007) for rough specular surfaces.
+ *  alpha: roughness; nor: macro surface normal (either orientation)
+ */
+
+/// samples a microfacet normal m with density D( m ) * |m * nor| from uv in [0,1)^2
+static inline v3d_s ggx_sample_normal( v3d_s nor, f3_t alpha, v2d_s uv )
+{
+    f3_t phi = 2.0 * M_PI * uv.x;
+    f3_t tan_sqr = alpha * alpha * uv.y / ( 1.0 - uv.y );
+    f3_t cos_t = 1.0 / sqrt( 1.0 + tan_sqr );
+    f3_t sin_t = sqrt( f3_max( 0, 1.0 - cos_t * cos_t ) );
+    m3d_s con = m3d_s_transposed( m3d_s_con_z( nor ) );
+    return m3d_s_mlv( &con, ( v3d_s ){ sin_t * cos( phi ), sin_t * sin( phi ), cos_t } );
+}
+
+/// smith shadowing-masking term for a direction with cosine cos_v to the macro normal
+static inline f3_t ggx_g1( f3_t cos_v, f3_t alpha )
+{
+    f3_t cos_sqr = cos_v * cos_v;
+    if( cos_sqr <= 0 ) return 0;
+    return 2.0 / ( 1.0 + sqrt( 1.0 + alpha * alpha * ( 1.0 - cos_sqr ) / cos_sqr ) );
+}
+
+/** Weight ( bsdf * cos / pdf, fresnel term excluded ) of direction dir_o obtained by reflecting or refracting
+ *  dir_i at a microfacet normal m sampled by ggx_sample_normal.
+ *  Returns 0 when m faces away from dir_i or when dir_o is on the wrong side of the macro surface.
+ */
+static inline f3_t ggx_weight( v3d_s dir_i, v3d_s dir_o, v3d_s nor, v3d_s m, f3_t alpha )
+{
+    f3_t i_n = v3d_s_mlv( dir_i, nor );
+    f3_t o_n = v3d_s_mlv( dir_o, nor );
+    f3_t i_m = v3d_s_mlv( dir_i, m );
+    f3_t o_m = v3d_s_mlv( dir_o, m );
+    f3_t m_n = v3d_s_mlv( m, nor );
+    if( i_n * i_m <= 0 || i_n * o_n * i_m * o_m <= 0 ) return 0;
+    return f3_abs( i_m ) * ggx_g1( i_n, alpha ) * ggx_g1( o_n, alpha ) / ( f3_abs( i_n ) * m_n );
 }
 
 /**********************************************************************************************************************/
@@ -0,0 +1,199 @@
+/** Irradiance Cache */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdatomic.h>
+
+#include "bcore_threads.h"
+
+#include "irradiance_cache.h"
+
+/**********************************************************************************************************************/
+
+/** Records are stored in chunks of fixed size, so that existing records never move.
+ *  The spatial index is a hashed uniform grid; cell size is the largest radius of influence
+ *  of a record ( accuracy * max_spacing ) so that a lookup needs to visit only the 27 neighboring cells.
+ */
+#define IRC_CHUNK_BITS 12
+#define IRC_CHUNK_SIZE ( 1 << IRC_CHUNK_BITS )
+#define IRC_MAX_CHUNKS 1024
+#define IRC_GRID_BITS  18
+#define IRC_GRID_SIZE  ( 1 << IRC_GRID_BITS )
+
+struct irradiance_cache_s
+{
+    f3_t accuracy;
+    f3_t min_spacing;
+    f3_t max_spacing;
+    f3_t cell_size;
+    uz_t size;
+    irc_record_s* chunk[ IRC_MAX_CHUNKS ];
+    _Atomic u2_t grid[ IRC_GRID_SIZE ]; // first record in cell + 1; 0: empty
+    bcore_mutex_s mutex;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+irradiance_cache_s* irradiance_cache_s_create( f3_t accuracy, f3_t min_spacing, f3_t max_spacing )
+{
+    irradiance_cache_s* o = bcore_alloc( NULL, sizeof( irradiance_cache_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+    o->accuracy    = accuracy;
+    o->min_spacing = min_spacing;
+    o->max_spacing = max_spacing > min_spacing ? max_spacing : min_spacing;
+    o->cell_size   = o->accuracy * o->max_spacing;
+    bcore_mutex_s_init( &o->mutex );
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void irradiance_cache_s_discard( irradiance_cache_s* o )
+{
+    if( !o ) return;
+    for( uz_t i = 0; i < IRC_MAX_CHUNKS; i++ ) if( o->chunk[ i ] ) bcore_free( o->chunk[ i ] );
+    bcore_mutex_s_down( &o->mutex );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+f3_t irradiance_cache_s_clamp_radius( const irradiance_cache_s* o, f3_t radius )
+{
+    return radius < o->min_spacing ? o->min_spacing : radius > o->max_spacing ? o->max_spacing : radius;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline s3_t irc_cell( const irradiance_cache_s* o, f3_t v )
+{
+    return floor( v / o->cell_size );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline u2_t irc_bucket( s3_t x, s3_t y, s3_t z )
+{
+    return crng_mix_u2( ( u2_t )x ^ crng_mix_u2( ( u2_t )y ^ crng_mix_u2( ( u2_t )z ) ) ) & ( IRC_GRID_SIZE - 1 );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline const irc_record_s* irc_record( const irradiance_cache_s* o, u2_t idx )
+{
+    return &o->chunk[ idx >> IRC_CHUNK_BITS ][ idx & ( IRC_CHUNK_SIZE - 1 ) ];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bl_t irradiance_cache_s_lookup( const irradiance_cache_s* o, v3d_s pos, v3d_s nor, uz_t depth, cl_s* irr )
+{
+    s3_t cx = irc_cell( o, pos.x );
+    s3_t cy = irc_cell( o, pos.y );
+    s3_t cz = irc_cell( o, pos.z );
+
+    u2_t visited[ 27 ];
+    uz_t visited_size = 0;
+
+    cl_s sum = { 0, 0, 0 };
+    f3_t sum_w = 0;
+
+    for( s3_t z = cz - 1; z <= cz + 1; z++ )
+    {
+        for( s3_t y = cy - 1; y <= cy + 1; y++ )
+        {
+            for( s3_t x = cx - 1; x <= cx + 1; x++ )
+            {
+                // different cells can share a bucket
+                u2_t bucket = irc_bucket( x, y, z );
+                bl_t seen = false;
+                for( uz_t i = 0; i < visited_size; i++ ) seen = seen || ( visited[ i ] == bucket );
+                if( seen ) continue;
+                visited[ visited_size++ ] = bucket;
+
+                const irc_record_s* rec = NULL;
+                for( u2_t idx = atomic_load_explicit( &o->grid[ bucket ], memory_order_acquire ); idx; idx = rec->next )
+                {
+                    rec = irc_record( o, idx - 1 );
+                    if( rec->depth < depth ) continue;
+
+                    v3d_s d = v3d_s_sub( pos, rec->pos );
+
+                    // record in front of pos: it might not account for geometry between both positions
+                    if( v3d_s_mlv( d, v3d_s_add( nor, rec->nor ) ) < -0.01 * rec->radius ) continue;
+
+                    // Ward's error estimate
+                    f3_t err = sqrt( v3d_s_sqr( d ) ) / rec->radius + sqrt( f3_max( 0, 1.0 - v3d_s_mlv( nor, rec->nor ) ) );
+                    if( err >= o->accuracy ) continue;
+
+                    f3_t w = 1.0 / f3_max( err, 1E-6 );
+                    v3d_s dn = v3d_s_sub( nor, rec->nor );
+                    cl_s e =
+                    {
+                        rec->irr.x + v3d_s_mlv( rec->grad_r, dn ),
+                        rec->irr.y + v3d_s_mlv( rec->grad_g, dn ),
+                        rec->irr.z + v3d_s_mlv( rec->grad_b, dn )
+                    };
+                    sum.x += w * f3_max( e.x, 0 );
+                    sum.y += w * f3_max( e.y, 0 );
+                    sum.z += w * f3_max( e.z, 0 );
+                    sum_w += w;
+                }
+            }
+        }
+    }
+
+    if( sum_w == 0 ) return false;
+    *irr = v3d_s_mlf( sum, 1.0 / sum_w );
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void irradiance_cache_s_insert( irradiance_cache_s* o, const irc_record_s* record )
+{
+    bcore_mutex_s_lock( &o->mutex );
+    if( o->size < IRC_MAX_CHUNKS * IRC_CHUNK_SIZE )
+    {
+        u2_t idx = o->size;
+        irc_record_s** chunk = &o->chunk[ idx >> IRC_CHUNK_BITS ];
+        if( !*chunk ) *chunk = bcore_alloc( NULL, sizeof( irc_record_s ) * IRC_CHUNK_SIZE );
+
+        u2_t bucket = irc_bucket( irc_cell( o, record->pos.x ), irc_cell( o, record->pos.y ), irc_cell( o, record->pos.z ) );
+        irc_record_s* rec = &( *chunk )[ idx & ( IRC_CHUNK_SIZE - 1 ) ];
+        *rec = *record;
+        rec->next = atomic_load_explicit( &o->grid[ bucket ], memory_order_relaxed );
+
+        // publishing: record (and chunk) are visible to readers acquiring the bucket
+        atomic_store_explicit( &o->grid[ bucket ], idx + 1, memory_order_release );
+        o->size++;
+    }
+    bcore_mutex_s_unlock( &o->mutex );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t irradiance_cache_s_size( irradiance_cache_s* o )
+{
+    bcore_mutex_s_lock( &o->mutex );
+    uz_t size = o->size;
+    bcore_mutex_s_unlock( &o->mutex );
+    return size;
+}
+
+/**********************************************************************************************************************/
+
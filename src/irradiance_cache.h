@@ -0,0 +1,74 @@
+/** Irradiance Cache */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** Irradiance cache (Ward et al. 1988; rotational gradients: Ward & Heckbert 1992).
+ *  Stores estimates of indirect diffuse irradiance at surface positions and interpolates them
+ *  for nearby shading points with similar surface normal.
+ *
+ *  The cache is built lazily during rendering and shared among render threads:
+ *  Lookups are lock-free; insertions are serialized by a mutex and published atomically.
+ *  Records are never moved or removed while the cache exists.
+ */
+typedef struct irradiance_cache_s irradiance_cache_s;
+
+/// cache record
+typedef struct irc_record_s
+{
+    v3d_s pos;
+    v3d_s nor;     // surface normal (pointing away from surface)
+    cl_s  irr;     // irradiance (per unit diffuse intensity)
+    v3d_s grad_r;  // rotational gradient of irr per color channel
+    v3d_s grad_g;
+    v3d_s grad_b;
+    f3_t  radius;  // harmonic mean distance to surrounding geometry
+    uz_t  depth;   // trace depth at which irr was computed
+    u2_t  next;    // (internal) next record in grid cell + 1; 0: none
+} irc_record_s;
+
+/** accuracy: maximum interpolation error (Ward's 'a'); typical values: 0.1 ... 0.3
+ *  min_spacing, max_spacing: clamping range of record radius
+ */
+irradiance_cache_s* irradiance_cache_s_create( f3_t accuracy, f3_t min_spacing, f3_t max_spacing );
+void                irradiance_cache_s_discard( irradiance_cache_s* o );
+
+/// clamps the record radius to the configured spacing range
+f3_t irradiance_cache_s_clamp_radius( const irradiance_cache_s* o, f3_t radius );
+
+/** Interpolates irradiance at pos with surface normal nor from records computed at a trace depth >= depth.
+ *  Returns false when no record is valid at pos. (Thread safe)
+ */
+bl_t irradiance_cache_s_lookup( const irradiance_cache_s* o, v3d_s pos, v3d_s nor, uz_t depth, cl_s* irr );
+
+/// adds a record (thread safe); record is ignored when the cache is full
+void irradiance_cache_s_insert( irradiance_cache_s* o, const irc_record_s* record );
+
+/// number of records
+uz_t irradiance_cache_s_size( irradiance_cache_s* o );
+
+/**********************************************************************************************************************/
+
+#endif // IRRADIANCE_CACHE_H
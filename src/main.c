@@ -14,6 +14,8 @@
  */
 
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "bcore_std.h"
 
@@ -28,6 +30,7 @@
 #include "gmath.h"
 #include "quicktypes.h"
 #include "distance.h"
+#include "sampler.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 
@@ -45,6 +48,7 @@ vd_t main_signal_handler( const bcore_signal_s* o )
         closures_signal_handler,
         gmath_signal_handler,
         distance_signal_handler,
+        sampler_signal_handler,
     };
     return bcore_signal_s_broadcast( o, arr, sizeof( arr ) / sizeof( bcore_fp_signal_handler ) );
 }
@@ -86,7 +90,7 @@ int main( int argc, const char** argv )
 
     if( argc < 2 )
     {
-        bcore_msg( "Usage: actinon <script file> [-f]\n" );
+        bcore_msg( "Usage: actinon <script file> [-f] [-r] [-crop=<x>,<y>,<width>,<height>] [-patch]\n" );
         return 1;
     }
 
@@ -106,6 +110,23 @@ int main( int argc, const char** argv )
         {
             scene_s_automatic_recover_g = true;
         }
+        else if( strncmp( arg->sc, "-crop=", 6 ) == 0 )
+        {
+            unsigned long x, y, w, h;
+            if( sscanf( arg->sc, "-crop=%lu,%lu,%lu,%lu", &x, &y, &w, &h ) != 4 )
+            {
+                bcore_err_fa( "Invalid crop window '#<sc_t>'. Expected: -crop=<x>,<y>,<width>,<height>\n", arg->sc );
+            }
+            scene_s_crop_override_g = true;
+            scene_s_crop_g[ 0 ] = x;
+            scene_s_crop_g[ 1 ] = y;
+            scene_s_crop_g[ 2 ] = w;
+            scene_s_crop_g[ 3 ] = h;
+        }
+        else if( st_s_equal_sc( arg, "-patch" ) )
+        {
+            scene_s_crop_patch_g = true;
+        }
         else
         {
             bcore_arr_st_s_push_sc( interpreter_args_g, argv[ i ] );
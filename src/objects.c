@@ -262,25 +262,7 @@ f3_t obj_ray_hit( vc_t o, const ray_s* ray, v3d_s* p_nor )
 {
     const obj_hdr_s* hdr = o;
     if( hdr->prp.envelope && !envelope_s_ray_hits( hdr->prp.envelope, ray ) ) return f3_inf;
-    f3_t a = hdr->p->fp_ray_hit( o, ray, p_nor );
-    if( a < f3_inf && hdr->prp.surface_roughness > 0 && p_nor )
-    {
-        v3d_s n = *p_nor;
-        u3_t rv = v3d_s_random_seed( ray_s_pos( ray, a ), 1246 );
-        f3_t f;
-
-        f = f3_rnd0( &rv ) * 0.99;
-        n.x += hdr->prp.surface_roughness * log( ( 1.0 - f ) / ( 1.0 + f ) );
-
-        f = f3_rnd0( &rv ) * 0.99;
-        n.y += hdr->prp.surface_roughness * log( ( 1.0 - f ) / ( 1.0 + f ) );
-
-        f = f3_rnd0( &rv ) * 0.99;
-        n.z += hdr->prp.surface_roughness * log( ( 1.0 - f ) / ( 1.0 + f ) );
-
-        *p_nor = v3d_s_of_length( n, 1.0 );
-    }
-    return a;
+    return hdr->p->fp_ray_hit( o, ray, p_nor );
 }
 
 f3_t obj_ray_exit( vc_t o, const ray_s* ray, v3d_s* p_nor )
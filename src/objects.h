@@ -48,6 +48,11 @@ envelope_s envelope_of_pair( const envelope_s* env1, const envelope_s* env2 );
 /**********************************************************************************************************************/
 /// properties_s  (object's properties)
 
+/** GGX roughness per unit surface_roughness;
+ *  approximates the slope spread of the former random perturbation of the surface normal
+ */
+#define OBJ_MICROFACET_ALPHA 2.5
+
 typedef struct properties_s
 {
     v3d_s pos;              // reference position of object
@@ -64,8 +69,8 @@ typedef struct properties_s
     f3_t diffuse_reflectivity;   // residual energy taken by diffuse reflection
     f3_t sigma;                  // sigma of Oren-Nayar reflectance model
 
-    /** surface roughness (r) is simulated by adding a random value in the range [-r, r] to the
-     *  each component of the surface normal and then renormalizing it.
+    /** surface roughness (r) of the specular (fresnel, chromatic) lobes:
+     *  GGX microfacet distribution of roughness alpha = OBJ_MICROFACET_ALPHA * r (see scene_s_lum)
      */
     f3_t surface_roughness;
 
@@ -0,0 +1,293 @@
+/** Occluder Grid */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+
+#include "gmath.h"
+#include "occluder_grid.h"
+
+/**********************************************************************************************************************/
+
+struct occluder_grid_s
+{
+    v3d_s min;        // grid origin
+    v3d_s cell_ext;   // extent of a cell
+    uz_t  cells;      // cells per axis
+    uz_t  lights;
+    uz_t  elements;   // number of elements in matter
+    bl_t* culled;     // per light: candidate lists exist
+    uz_t* offs;       // candidates of ( light, cell ) are idx[ offs[ i ] ... offs[ i + 1 ] - 1 ]; i = light * cells^3 + cell
+    vc_t* idx;
+    uz_t  size;
+    uz_t  space;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// bounding sphere of a matter element; returns false if the element has no known bounds
+static bl_t element_bounds( vc_t element, v3d_s* pos, f3_t* radius )
+{
+    const envelope_s* env = NULL;
+    tp_t type = *( const aware_t* )element;
+    if( type == TYPEOF_compound_s )
+    {
+        env = compound_s_get_envelope( element );
+    }
+    else
+    {
+        env = ( ( const obj_hdr_s* )element )->prp.envelope;
+        if( !env && type == TYPEOF_obj_sphere_s )
+        {
+            *pos    = ( ( const obj_hdr_s* )element )->prp.pos;
+            *radius = obj_sphere_s_get_radius( element );
+            return true;
+        }
+    }
+
+    if( !env ) return false;
+    *pos    = env->pos;
+    *radius = env->radius;
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** True when element can intersect a segment between a position inside the sphere (cell_pos, cell_rad)
+ *  and a position inside the sphere (light_pos, light_rad).
+ */
+static bl_t is_candidate( vc_t element, v3d_s cell_pos, f3_t cell_rad, v3d_s light_pos, f3_t light_rad )
+{
+    v3d_s diff = v3d_s_sub( light_pos, cell_pos );
+    f3_t dist = sqrt( v3d_s_sqr( diff ) );
+    if( dist <= cell_rad + light_rad ) return true;
+
+    /** All segments lie inside the half-sphere with base at cell_pos - cell_rad * dir facing the light
+     *  and inside the capsule around the center connection with radius max( cell_rad, light_rad ).
+     */
+    ray_s field;
+    field.d = v3d_s_mlf( diff, 1.0 / dist );
+    field.p = v3d_s_sub( cell_pos, v3d_s_mlf( field.d, cell_rad ) );
+    f3_t length = dist + light_rad + cell_rad;
+
+    v3d_s pos;
+    f3_t radius;
+    bl_t bounded = element_bounds( element, &pos, &radius );
+
+    if( *( const aware_t* )element == TYPEOF_compound_s )
+    {
+        if( bounded && !sphere_intersects_half_sphere( pos, radius, &field, length ) ) return false;
+    }
+    else
+    {
+        if( !obj_is_reachable( element, &field, length ) ) return false;
+    }
+
+    if( !bounded ) return true;
+
+    f3_t t = v3d_s_mlv( v3d_s_sub( pos, cell_pos ), diff ) / f3_sqr( dist );
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    f3_t dist_sqr = v3d_s_diff_sqr( pos, v3d_s_add( cell_pos, v3d_s_mlf( diff, t ) ) );
+    return dist_sqr <= f3_sqr( radius + f3_max( cell_rad, light_rad ) );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void occluder_grid_s_push( occluder_grid_s* o, vc_t element )
+{
+    if( o->size == o->space )
+    {
+        o->space = o->space > 0 ? o->space * 2 : 1024;
+        o->idx = bcore_alloc( o->idx, sizeof( vc_t ) * o->space );
+    }
+    o->idx[ o->size++ ] = element;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+occluder_grid_s* occluder_grid_s_create( const compound_s* matter, const compound_s* light, uz_t cells )
+{
+    occluder_grid_s* o = bcore_alloc( NULL, sizeof( occluder_grid_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+
+    o->cells    = cells > 0 ? cells : 1;
+    o->lights   = compound_s_get_size( light );
+    o->elements = compound_s_get_size( matter );
+
+    uz_t cell_count = o->cells * o->cells * o->cells;
+    o->culled = bcore_alloc( NULL, sizeof( bl_t ) * ( o->lights > 0 ? o->lights : 1 ) );
+    o->offs   = bcore_alloc( NULL, sizeof( uz_t ) * ( o->lights * cell_count + 1 ) );
+    bcore_memzero( o->culled, sizeof( bl_t ) * ( o->lights > 0 ? o->lights : 1 ) );
+    bcore_memzero( o->offs,   sizeof( uz_t ) * ( o->lights * cell_count + 1 ) );
+
+    // bounding box of bounded elements
+    bl_t bounded = false;
+    v3d_s min = v3d_s_zero();
+    v3d_s max = v3d_s_zero();
+    for( uz_t i = 0; i < o->elements; i++ )
+    {
+        v3d_s pos;
+        f3_t radius;
+        if( !element_bounds( compound_s_get_object( matter, i ), &pos, &radius ) ) continue;
+        v3d_s e_min = { pos.x - radius, pos.y - radius, pos.z - radius };
+        v3d_s e_max = { pos.x + radius, pos.y + radius, pos.z + radius };
+        if( !bounded )
+        {
+            min = e_min;
+            max = e_max;
+            bounded = true;
+        }
+        else
+        {
+            min.x = f3_min( min.x, e_min.x ); max.x = f3_max( max.x, e_max.x );
+            min.y = f3_min( min.y, e_min.y ); max.y = f3_max( max.y, e_max.y );
+            min.z = f3_min( min.z, e_min.z ); max.z = f3_max( max.z, e_max.z );
+        }
+    }
+
+    if( !bounded ) return o;
+
+    o->min = min;
+    o->cell_ext = v3d_s_mlf( v3d_s_sub( max, min ), 1.0 / o->cells );
+    o->cell_ext.x = f3_max( o->cell_ext.x, f3_eps );
+    o->cell_ext.y = f3_max( o->cell_ext.y, f3_eps );
+    o->cell_ext.z = f3_max( o->cell_ext.z, f3_eps );
+    f3_t cell_rad = 0.5 * sqrt( v3d_s_sqr( o->cell_ext ) );
+
+    for( uz_t l = 0; l < o->lights; l++ )
+    {
+        v3d_s light_pos;
+        f3_t light_rad;
+        o->culled[ l ] = element_bounds( compound_s_get_object( light, l ), &light_pos, &light_rad );
+
+        for( uz_t cell = 0; cell < cell_count; cell++ )
+        {
+            if( o->culled[ l ] )
+            {
+                uz_t x = cell % o->cells;
+                uz_t y = ( cell / o->cells ) % o->cells;
+                uz_t z = cell / ( o->cells * o->cells );
+                v3d_s cell_pos =
+                {
+                    o->min.x + ( x + 0.5 ) * o->cell_ext.x,
+                    o->min.y + ( y + 0.5 ) * o->cell_ext.y,
+                    o->min.z + ( z + 0.5 ) * o->cell_ext.z
+                };
+
+                for( uz_t i = 0; i < o->elements; i++ )
+                {
+                    vc_t element = compound_s_get_object( matter, i );
+                    if( is_candidate( element, cell_pos, cell_rad, light_pos, light_rad ) ) occluder_grid_s_push( o, element );
+                }
+            }
+            o->offs[ l * cell_count + cell + 1 ] = o->size;
+        }
+    }
+
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void occluder_grid_s_discard( occluder_grid_s* o )
+{
+    if( !o ) return;
+    if( o->idx ) bcore_free( o->idx );
+    bcore_free( o->offs );
+    bcore_free( o->culled );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bl_t occluder_grid_s_get( const occluder_grid_s* o, uz_t light_index, v3d_s pos, occluder_list_s* list )
+{
+    if( light_index >= o->lights || !o->culled[ light_index ] ) return false;
+    f3_t fx = ( pos.x - o->min.x ) / o->cell_ext.x;
+    f3_t fy = ( pos.y - o->min.y ) / o->cell_ext.y;
+    f3_t fz = ( pos.z - o->min.z ) / o->cell_ext.z;
+    if( fx < 0 || fy < 0 || fz < 0 || fx >= o->cells || fy >= o->cells || fz >= o->cells ) return false;
+
+    uz_t cell = ( ( uz_t )fz * o->cells + ( uz_t )fy ) * o->cells + ( uz_t )fx;
+    uz_t i = light_index * o->cells * o->cells * o->cells + cell;
+    list->data = o->idx + o->offs[ i ];
+    list->size = o->offs[ i + 1 ] - o->offs[ i ];
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+f3_t occluder_grid_s_avg_candidates( const occluder_grid_s* o )
+{
+    uz_t culled = 0;
+    for( uz_t i = 0; i < o->lights; i++ ) culled += o->culled[ i ];
+    return culled > 0 ? ( f3_t )o->size / ( culled * o->cells * o->cells * o->cells ) : o->elements;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t occluder_grid_s_elements( const occluder_grid_s* o )
+{
+    return o->elements;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bl_t occluder_list_s_occludes( const occluder_list_s* o, const ray_s* ray, f3_t length, vc_t* occluder )
+{
+    for( uz_t i = 0; i < o->size; i++ )
+    {
+        vc_t element = o->data[ i ];
+        f3_t a = ( *( const aware_t* )element == TYPEOF_compound_s )
+                 ? compound_s_ray_hit( element, ray, NULL, NULL )
+                 : obj_ray_hit( element, ray, NULL );
+        if( a <= length )
+        {
+            if( occluder ) *occluder = element;
+            return true;
+        }
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void occluder_list_s_ray_group_occlusion( const occluder_list_s* o, const ray_s* ray, const f3_t* length, bl_t* occluded, vc_t* occluder, uz_t size )
+{
+    for( uz_t i = 0; i < o->size; i++ )
+    {
+        vc_t element = o->data[ i ];
+        if( *( const aware_t* )element == TYPEOF_compound_s )
+        {
+            compound_s_ray_group_occlusion( element, ray, length, occluded, occluder, size );
+        }
+        else
+        {
+            for( uz_t j = 0; j < size; j++ )
+            {
+                if( occluded[ j ] ) continue;
+                if( obj_ray_hit( element, &ray[ j ], NULL ) <= length[ j ] )
+                {
+                    occluded[ j ] = true;
+                    if( occluder ) occluder[ j ] = element;
+                }
+            }
+        }
+    }
+}
+
+/**********************************************************************************************************************/
+
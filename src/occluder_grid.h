@@ -0,0 +1,71 @@
+/** Occluder Grid */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef OCCLUDER_GRID_H
+#define OCCLUDER_GRID_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+#include "compound.h"
+
+/**********************************************************************************************************************/
+
+/** Per light source candidate lists of occluders.
+ *  The bounding box of all bounded matter elements is divided into a uniform grid.
+ *  For each light source and grid cell, the list contains those top-level elements of matter
+ *  which can potentially intersect a segment between a position inside the cell and the light source.
+ *  Elements without known bounds are treated conservatively (tested via obj_is_reachable only).
+ *
+ *  The grid is built once before rendering and is read-only afterwards.
+ */
+typedef struct occluder_grid_s occluder_grid_s;
+
+/// list of candidate occluders
+typedef struct occluder_list_s
+{
+    vc_t* data;
+    uz_t  size;
+} occluder_list_s;
+
+/// cells: number of cells per axis
+occluder_grid_s* occluder_grid_s_create( const compound_s* matter, const compound_s* light, uz_t cells );
+void             occluder_grid_s_discard( occluder_grid_s* o );
+
+/** Retrieves the candidates between pos and light source of index light_index (index in light compound).
+ *  Returns false when no list is available (pos outside grid or light source without bounds);
+ *  in that case all matter objects are candidates.
+ */
+bl_t occluder_grid_s_get( const occluder_grid_s* o, uz_t light_index, v3d_s pos, occluder_list_s* list );
+
+/// average number of candidates per cell of culled light sources; total number of elements in matter
+f3_t occluder_grid_s_avg_candidates( const occluder_grid_s* o );
+uz_t occluder_grid_s_elements( const occluder_grid_s* o );
+
+/** True when ray hits a candidate at an offset <= length.
+ *  occluder (optional; may be NULL): receives the occluding candidate
+ */
+bl_t occluder_list_s_occludes( const occluder_list_s* o, const ray_s* ray, f3_t length, vc_t* occluder );
+
+/// group version (see compound_s_ray_group_occlusion)
+void occluder_list_s_ray_group_occlusion( const occluder_list_s* o, const ray_s* ray, const f3_t* length, bl_t* occluded, vc_t* occluder, uz_t size );
+
+/**********************************************************************************************************************/
+
+#endif // OCCLUDER_GRID_H
@@ -0,0 +1,386 @@
+/** Path Guide */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+
+#include "bcore_threads.h"
+
+#include "path_guide.h"
+
+/**********************************************************************************************************************/
+
+#define PG_MAX_RECORDS       ( 1 << 20 ) // size of record reservoir
+#define PG_LEAF_RECORDS      4096        // spatial nodes with more records are subdivided
+#define PG_MAX_SPATIAL_DEPTH 24
+#define PG_DIR_FRACTION      0.01        // directional nodes holding a larger fraction of the energy are subdivided
+#define PG_DIR_MAX_DEPTH     10
+
+/// directional quadtree node; quadrant q = qu + 2 * qv; child 0: quadrant is a leaf
+typedef struct pg_dnode_s
+{
+    f3_t energy[ 4 ];
+    u2_t child[ 4 ];
+} pg_dnode_s;
+
+/// spatial kd-tree node; axis 3: leaf; otherwise children are child (< split) and child + 1
+typedef struct pg_snode_s
+{
+    u2_t axis;
+    f3_t split;
+    u2_t child;
+    uz_t dist;
+} pg_snode_s;
+
+/// training sample
+typedef struct pg_sample_s
+{
+    v3d_s pos;
+    f3_t u, v;
+    f3_t value;
+} pg_sample_s;
+
+struct path_guide_s
+{
+    path_guide_record_s* rec;
+    uz_t rec_size;
+    uz_t rec_space;
+    u3_t rec_seen;
+    crng_s rng;
+    bcore_mutex_s mutex;
+
+    pg_snode_s* snode;
+    uz_t snode_size;
+    uz_t snode_space;
+
+    pg_dnode_s* dnode;
+    uz_t dnode_size;
+    uz_t dnode_space;
+
+    uz_t regions;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+path_guide_s* path_guide_s_create( void )
+{
+    path_guide_s* o = bcore_alloc( NULL, sizeof( path_guide_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+    crng_s_init( &o->rng, 0x3C6EF372, 0xA54FF53A, 0 );
+    bcore_mutex_s_init( &o->mutex );
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void path_guide_s_discard( path_guide_s* o )
+{
+    if( !o ) return;
+    if( o->rec   ) bcore_free( o->rec );
+    if( o->snode ) bcore_free( o->snode );
+    if( o->dnode ) bcore_free( o->dnode );
+    bcore_mutex_s_down( &o->mutex );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void path_guide_s_push( path_guide_s* o, const path_guide_record_s* records, uz_t size )
+{
+    bcore_mutex_s_lock( &o->mutex );
+    for( uz_t i = 0; i < size; i++ )
+    {
+        if( !( records[ i ].value > 0 ) ) continue;
+        if( o->rec_size < PG_MAX_RECORDS )
+        {
+            if( o->rec_size == o->rec_space )
+            {
+                o->rec_space = o->rec_space > 0 ? o->rec_space * 2 : 4096;
+                o->rec = bcore_alloc( o->rec, sizeof( path_guide_record_s ) * o->rec_space );
+            }
+            o->rec[ o->rec_size++ ] = records[ i ];
+        }
+        else
+        {
+            // reservoir sampling: each record seen so far is retained with equal probability
+            u3_t j = ( ( ( u3_t )crng_s_u2( &o->rng ) << 32 ) | crng_s_u2( &o->rng ) ) % ( o->rec_seen + 1 );
+            if( j < PG_MAX_RECORDS ) o->rec[ j ] = records[ i ];
+        }
+        o->rec_seen++;
+    }
+    bcore_mutex_s_unlock( &o->mutex );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t path_guide_s_records( const path_guide_s* o )
+{
+    return o->rec_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t path_guide_s_regions( const path_guide_s* o )
+{
+    return o->regions;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// cylindrical equal-area mapping of the sphere onto the unit square
+static inline v2d_s pg_uv_of_dir( v3d_s dir )
+{
+    v2d_s uv;
+    uv.x = 0.5 * ( dir.z + 1.0 );
+    uv.y = atan2( dir.y, dir.x ) * ( 0.5 / M_PI ) + 0.5;
+    uv.x = f3_min( f3_max( uv.x, 0 ), 1.0 );
+    uv.y = f3_min( f3_max( uv.y, 0 ), 1.0 );
+    return uv;
+}
+
+static inline v3d_s pg_dir_of_uv( v2d_s uv )
+{
+    f3_t z = 2.0 * uv.x - 1.0;
+    f3_t r = sqrt( f3_max( 0, 1.0 - z * z ) );
+    f3_t phi = 2.0 * M_PI * ( uv.y - 0.5 );
+    return ( v3d_s ){ r * cos( phi ), r * sin( phi ), z };
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static uz_t pg_snode_new( path_guide_s* o )
+{
+    if( o->snode_size == o->snode_space )
+    {
+        o->snode_space = o->snode_space > 0 ? o->snode_space * 2 : 256;
+        o->snode = bcore_alloc( o->snode, sizeof( pg_snode_s ) * o->snode_space );
+    }
+    bcore_memzero( &o->snode[ o->snode_size ], sizeof( pg_snode_s ) );
+    return o->snode_size++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static uz_t pg_dnode_new( path_guide_s* o )
+{
+    if( o->dnode_size == o->dnode_space )
+    {
+        o->dnode_space = o->dnode_space > 0 ? o->dnode_space * 2 : 1024;
+        o->dnode = bcore_alloc( o->dnode, sizeof( pg_dnode_s ) * o->dnode_space );
+    }
+    bcore_memzero( &o->dnode[ o->dnode_size ], sizeof( pg_dnode_s ) );
+    return o->dnode_size++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline void pg_swap( pg_sample_s* a, pg_sample_s* b )
+{
+    pg_sample_s t = *a; *a = *b; *b = t;
+}
+
+/// partitions [lo, hi) such that samples with component < split come first; returns end of first part
+static uz_t pg_partition( pg_sample_s* s, uz_t lo, uz_t hi, uz_t component, f3_t split )
+{
+    uz_t store = lo;
+    for( uz_t i = lo; i < hi; i++ )
+    {
+        f3_t c = component == 0 ? s[ i ].pos.x : component == 1 ? s[ i ].pos.y : component == 2 ? s[ i ].pos.z :
+                 component == 3 ? s[ i ].u : s[ i ].v;
+        if( c < split ) pg_swap( &s[ i ], &s[ store++ ] );
+    }
+    return store;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void pg_build_dnode( path_guide_s* o, uz_t node, pg_sample_s* s, uz_t lo, uz_t hi, f3_t u0, f3_t v0, f3_t size, f3_t total, uz_t depth )
+{
+    f3_t half = 0.5 * size;
+    uz_t mu = pg_partition( s, lo, hi, 3, u0 + half );
+    uz_t m0 = pg_partition( s, lo, mu, 4, v0 + half );
+    uz_t m1 = pg_partition( s, mu, hi, 4, v0 + half );
+    uz_t beg[ 4 ] = { lo, mu, m0, m1 };
+    uz_t end[ 4 ] = { m0, m1, mu, hi };
+
+    for( uz_t q = 0; q < 4; q++ )
+    {
+        f3_t energy = 0;
+        for( uz_t i = beg[ q ]; i < end[ q ]; i++ ) energy += s[ i ].value;
+        o->dnode[ node ].energy[ q ] = energy;
+
+        if( energy > PG_DIR_FRACTION * total && depth + 1 < PG_DIR_MAX_DEPTH && end[ q ] - beg[ q ] > 1 )
+        {
+            uz_t child = pg_dnode_new( o );
+            o->dnode[ node ].child[ q ] = child;
+            pg_build_dnode( o, child, s, beg[ q ], end[ q ], u0 + ( q & 1 ) * half, v0 + ( q >> 1 ) * half, half, total, depth + 1 );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void pg_build_snode( path_guide_s* o, uz_t node, pg_sample_s* s, uz_t lo, uz_t hi, uz_t depth )
+{
+    if( hi - lo > PG_LEAF_RECORDS && depth < PG_MAX_SPATIAL_DEPTH )
+    {
+        v3d_s min = s[ lo ].pos;
+        v3d_s max = s[ lo ].pos;
+        for( uz_t i = lo + 1; i < hi; i++ )
+        {
+            v3d_s p = s[ i ].pos;
+            min.x = f3_min( min.x, p.x ); max.x = f3_max( max.x, p.x );
+            min.y = f3_min( min.y, p.y ); max.y = f3_max( max.y, p.y );
+            min.z = f3_min( min.z, p.z ); max.z = f3_max( max.z, p.z );
+        }
+        v3d_s ext = v3d_s_sub( max, min );
+        u2_t axis = ( ext.x >= ext.y && ext.x >= ext.z ) ? 0 : ( ext.y >= ext.z ) ? 1 : 2;
+        f3_t split = 0.5 * ( axis == 0 ? min.x + max.x : axis == 1 ? min.y + max.y : min.z + max.z );
+        uz_t mid = pg_partition( s, lo, hi, axis, split );
+
+        if( mid > lo && mid < hi )
+        {
+            uz_t child = pg_snode_new( o );
+            pg_snode_new( o );
+            o->snode[ node ].axis  = axis;
+            o->snode[ node ].split = split;
+            o->snode[ node ].child = child;
+            pg_build_snode( o, child,     s, lo, mid, depth + 1 );
+            pg_build_snode( o, child + 1, s, mid, hi, depth + 1 );
+            return;
+        }
+    }
+
+    o->snode[ node ].axis = 3;
+    o->snode[ node ].dist = PATH_GUIDE_NONE;
+    o->regions++;
+
+    f3_t total = 0;
+    for( uz_t i = lo; i < hi; i++ ) total += s[ i ].value;
+    if( total > 0 )
+    {
+        uz_t root = pg_dnode_new( o );
+        o->snode[ node ].dist = root;
+        pg_build_dnode( o, root, s, lo, hi, 0, 0, 1.0, total, 0 );
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void path_guide_s_train( path_guide_s* o )
+{
+    o->snode_size = 0;
+    o->dnode_size = 0;
+    o->regions = 0;
+    if( o->rec_size == 0 ) return;
+
+    pg_sample_s* s = bcore_alloc( NULL, sizeof( pg_sample_s ) * o->rec_size );
+    for( uz_t i = 0; i < o->rec_size; i++ )
+    {
+        v2d_s uv = pg_uv_of_dir( o->rec[ i ].dir );
+        s[ i ].pos   = o->rec[ i ].pos;
+        s[ i ].u     = uv.x;
+        s[ i ].v     = uv.y;
+        s[ i ].value = o->rec[ i ].value;
+    }
+
+    uz_t root = pg_snode_new( o );
+    pg_build_snode( o, root, s, 0, o->rec_size, 0 );
+
+    bcore_free( s );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t path_guide_s_dist( const path_guide_s* o, v3d_s pos )
+{
+    if( o->snode_size == 0 ) return PATH_GUIDE_NONE;
+    const pg_snode_s* node = &o->snode[ 0 ];
+    while( node->axis != 3 )
+    {
+        f3_t c = node->axis == 0 ? pos.x : node->axis == 1 ? pos.y : pos.z;
+        node = &o->snode[ node->child + ( c < node->split ? 0 : 1 ) ];
+    }
+    return node->dist;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Hierarchical sample warping: In each node, uv.x selects the column (qu) and uv.y the row (qv)
+ *  of the quadrant in proportion to the energy; uv is rescaled for the next level.
+ */
+v3d_s path_guide_s_sample( const path_guide_s* o, uz_t dist, v2d_s uv, f3_t* pdf )
+{
+    f3_t u0 = 0, v0 = 0, size = 1.0, p = 1.0;
+    uz_t node = dist;
+    while( true )
+    {
+        const f3_t* e = o->dnode[ node ].energy;
+        f3_t total = e[ 0 ] + e[ 1 ] + e[ 2 ] + e[ 3 ];
+
+        f3_t p_left = ( total > 0 ) ? ( e[ 0 ] + e[ 2 ] ) / total : 0.5;
+        uz_t qu = ( uv.x < p_left ) ? 0 : 1;
+        uv.x = qu ? ( uv.x - p_left ) / ( 1.0 - p_left ) : uv.x / p_left;
+
+        f3_t col = e[ qu ] + e[ qu + 2 ];
+        f3_t p_low = ( col > 0 ) ? e[ qu ] / col : 0.5;
+        uz_t qv = ( uv.y < p_low ) ? 0 : 1;
+        uv.y = qv ? ( uv.y - p_low ) / ( 1.0 - p_low ) : uv.y / p_low;
+
+        uz_t q = qu + 2 * qv;
+        p *= ( total > 0 ) ? 4.0 * e[ q ] / total : 1.0;
+
+        size *= 0.5;
+        u0 += qu * size;
+        v0 += qv * size;
+
+        if( !o->dnode[ node ].child[ q ] ) break;
+        node = o->dnode[ node ].child[ q ];
+    }
+
+    uv.x = f3_min( f3_max( uv.x, 0 ), 1.0 );
+    uv.y = f3_min( f3_max( uv.y, 0 ), 1.0 );
+
+    // area element of the cylindrical mapping: 4 * PI
+    *pdf = p / ( 4.0 * M_PI );
+    return pg_dir_of_uv( ( v2d_s ){ u0 + uv.x * size, v0 + uv.y * size } );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+f3_t path_guide_s_pdf( const path_guide_s* o, uz_t dist, v3d_s dir )
+{
+    v2d_s uv = pg_uv_of_dir( dir );
+    f3_t p = 1.0;
+    uz_t node = dist;
+    while( true )
+    {
+        const f3_t* e = o->dnode[ node ].energy;
+        f3_t total = e[ 0 ] + e[ 1 ] + e[ 2 ] + e[ 3 ];
+        uz_t qu = ( uv.x >= 0.5 ) ? 1 : 0;
+        uz_t qv = ( uv.y >= 0.5 ) ? 1 : 0;
+        uz_t q = qu + 2 * qv;
+        p *= ( total > 0 ) ? 4.0 * e[ q ] / total : 1.0;
+        if( !o->dnode[ node ].child[ q ] ) break;
+        uv.x = 2.0 * uv.x - qu;
+        uv.y = 2.0 * uv.y - qv;
+        node = o->dnode[ node ].child[ q ];
+    }
+    return p / ( 4.0 * M_PI );
+}
+
+/**********************************************************************************************************************/
+
@@ -0,0 +1,74 @@
+/** Path Guide */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef PATH_GUIDE_H
+#define PATH_GUIDE_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** Path guiding with a spatial-directional tree (SD-tree; Mueller, Gross & Novak 2017).
+ *  Space is subdivided by a kd-tree; each spatial leaf holds a quadtree over the sphere of directions
+ *  (cylindrical equal-area mapping) approximating the distribution of incident radiance.
+ *
+ *  During rendering, tracers push radiance records (thread safe). Between render passes
+ *  path_guide_s_train rebuilds the tree from all collected records (reservoir of bounded size).
+ *  Sampling and density evaluation are read-only and can be used concurrently.
+ */
+typedef struct path_guide_s path_guide_s;
+
+/// radiance record
+typedef struct path_guide_record_s
+{
+    v3d_s pos;
+    v3d_s dir;   // direction of incidence (pointing away from pos)
+    f3_t  value; // incident radiance divided by the probability density of dir
+} path_guide_record_s;
+
+/// no directional distribution
+#define PATH_GUIDE_NONE ( ( uz_t )-1 )
+
+path_guide_s* path_guide_s_create( void );
+void          path_guide_s_discard( path_guide_s* o );
+
+/// adds records (thread safe)
+void path_guide_s_push( path_guide_s* o, const path_guide_record_s* records, uz_t size );
+
+/// rebuilds the tree from collected records (not thread safe)
+void path_guide_s_train( path_guide_s* o );
+
+/// number of collected records; number of spatial regions of the trained tree
+uz_t path_guide_s_records( const path_guide_s* o );
+uz_t path_guide_s_regions( const path_guide_s* o );
+
+/// directional distribution at pos; PATH_GUIDE_NONE when untrained
+uz_t path_guide_s_dist( const path_guide_s* o, v3d_s pos );
+
+/// samples a direction from distribution dist using uv in [0,1)^2; *pdf receives the density (per steradian)
+v3d_s path_guide_s_sample( const path_guide_s* o, uz_t dist, v2d_s uv, f3_t* pdf );
+
+/// density (per steradian) of direction dir in distribution dist
+f3_t path_guide_s_pdf( const path_guide_s* o, uz_t dist, v3d_s dir );
+
+/**********************************************************************************************************************/
+
+#endif // PATH_GUIDE_H
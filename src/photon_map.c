@@ -0,0 +1,181 @@
+/** Photon Map */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+
+#include "photon_map.h"
+
+/**********************************************************************************************************************/
+
+struct photon_map_s
+{
+    photon_s* data;
+    uz_t size;
+    uz_t space;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+photon_map_s* photon_map_s_create( void )
+{
+    photon_map_s* o = bcore_alloc( NULL, sizeof( photon_map_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void photon_map_s_discard( photon_map_s* o )
+{
+    if( !o ) return;
+    if( o->data ) bcore_free( o->data );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void photon_map_s_push( photon_map_s* o, v3d_s pos, v3d_s dir, cl_s power )
+{
+    if( o->size == o->space )
+    {
+        o->space = o->space > 0 ? o->space * 2 : 1024;
+        o->data = bcore_alloc( o->data, sizeof( photon_s ) * o->space );
+    }
+    o->data[ o->size++ ] = ( photon_s ){ .pos = pos, .dir = dir, .power = power, .axis = 0 };
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t photon_map_s_size( const photon_map_s* o )
+{
+    return o->size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline f3_t photon_axis( v3d_s v, u2_t axis )
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline void photon_swap( photon_s* a, photon_s* b )
+{
+    photon_s t = *a; *a = *b; *b = t;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// partial sort of [lo, hi) such that element k is in sorted position (quickselect)
+static void photon_select( photon_s* data, uz_t lo, uz_t hi, uz_t k, u2_t axis )
+{
+    while( hi - lo > 1 )
+    {
+        photon_swap( &data[ ( lo + hi ) >> 1 ], &data[ hi - 1 ] );
+        f3_t pivot = photon_axis( data[ hi - 1 ].pos, axis );
+        uz_t store = lo;
+        for( uz_t i = lo; i < hi - 1; i++ )
+        {
+            if( photon_axis( data[ i ].pos, axis ) < pivot ) photon_swap( &data[ i ], &data[ store++ ] );
+        }
+        photon_swap( &data[ store ], &data[ hi - 1 ] );
+
+        if( k == store ) return;
+        if( k < store ) hi = store; else lo = store + 1;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// node of range [lo, hi) is at ( lo + hi ) / 2; it splits along the axis of largest extent
+static void photon_build( photon_s* data, uz_t lo, uz_t hi )
+{
+    if( hi - lo <= 1 ) return;
+
+    v3d_s min = data[ lo ].pos;
+    v3d_s max = data[ lo ].pos;
+    for( uz_t i = lo + 1; i < hi; i++ )
+    {
+        v3d_s p = data[ i ].pos;
+        min.x = f3_min( min.x, p.x ); max.x = f3_max( max.x, p.x );
+        min.y = f3_min( min.y, p.y ); max.y = f3_max( max.y, p.y );
+        min.z = f3_min( min.z, p.z ); max.z = f3_max( max.z, p.z );
+    }
+    v3d_s ext = v3d_s_sub( max, min );
+    u2_t axis = ( ext.x >= ext.y && ext.x >= ext.z ) ? 0 : ( ext.y >= ext.z ) ? 1 : 2;
+
+    uz_t mid = ( lo + hi ) >> 1;
+    photon_select( data, lo, hi, mid, axis );
+    data[ mid ].axis = axis;
+
+    photon_build( data, lo, mid );
+    photon_build( data, mid + 1, hi );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void photon_map_s_build( photon_map_s* o )
+{
+    photon_build( o->data, 0, o->size );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void photon_gather( const photon_s* data, uz_t lo, uz_t hi, v3d_s pos, v3d_s nor, f3_t radius, cl_s* sum )
+{
+    f3_t r2 = radius * radius;
+    while( lo < hi )
+    {
+        uz_t mid = ( lo + hi ) >> 1;
+        const photon_s* p = &data[ mid ];
+        v3d_s d = v3d_s_sub( p->pos, pos );
+
+        // disk shaped gather region avoids bleeding across nearby surfaces
+        if( v3d_s_sqr( d ) < r2 && f3_abs( v3d_s_mlv( d, nor ) ) < 0.25 * radius && v3d_s_mlv( p->dir, nor ) < 0 )
+        {
+            *sum = v3d_s_add( *sum, p->power );
+        }
+
+        if( hi - lo == 1 ) return;
+
+        f3_t delta = photon_axis( pos, p->axis ) - photon_axis( p->pos, p->axis );
+        if( delta < 0 )
+        {
+            if( delta * delta < r2 ) photon_gather( data, mid + 1, hi, pos, nor, radius, sum );
+            hi = mid;
+        }
+        else
+        {
+            if( delta * delta < r2 ) photon_gather( data, lo, mid, pos, nor, radius, sum );
+            lo = mid + 1;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+cl_s photon_map_s_irradiance( const photon_map_s* o, v3d_s pos, v3d_s nor, f3_t radius )
+{
+    cl_s sum = { 0, 0, 0 };
+    if( o->size == 0 || radius <= 0 ) return sum;
+    photon_gather( o->data, 0, o->size, pos, nor, radius, &sum );
+    return v3d_s_mlf( sum, 1.0 / ( M_PI * radius * radius ) );
+}
+
+/**********************************************************************************************************************/
+
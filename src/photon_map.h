@@ -0,0 +1,59 @@
+/** Photon Map */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** Photon map (Jensen 1996) stored as balanced kd-tree.
+ *  Photons are pushed during a single threaded pre-pass; after photon_map_s_build
+ *  the map is read-only and can be queried concurrently.
+ */
+typedef struct photon_s
+{
+    v3d_s pos;
+    v3d_s dir;   // direction of incidence
+    cl_s  power; // flux
+    u2_t  axis;  // (internal) split axis of kd-node
+} photon_s;
+
+typedef struct photon_map_s photon_map_s;
+
+photon_map_s* photon_map_s_create( void );
+void          photon_map_s_discard( photon_map_s* o );
+
+void photon_map_s_push( photon_map_s* o, v3d_s pos, v3d_s dir, cl_s power );
+
+/// balances the kd-tree; required before querying
+void photon_map_s_build( photon_map_s* o );
+
+uz_t photon_map_s_size( const photon_map_s* o );
+
+/** Irradiance at pos on a surface with normal nor (pointing away from surface).
+ *  Density estimate over photons within a disk of given radius around pos.
+ */
+cl_s photon_map_s_irradiance( const photon_map_s* o, v3d_s pos, v3d_s nor, f3_t radius );
+
+/**********************************************************************************************************************/
+
+#endif // PHOTON_MAP_H
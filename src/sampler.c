@@ -0,0 +1,301 @@
+/** Sample Generators */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+
+#include "sampler.h"
+
+/**********************************************************************************************************************/
+/// blue noise mask
+
+#define BN_BITS 6
+#define BN_SIZE ( 1 << BN_BITS )
+#define BN_MASK ( BN_SIZE - 1 )
+#define BN_AREA ( BN_SIZE * BN_SIZE )
+
+/// toroidal blue-noise mask with values evenly distributed in (0,1)
+static f3_t blue_noise_mask_g[ BN_AREA ];
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// adds (sign = 1) or removes (sign = -1) the gaussian energy of a point at pos
+static void bn_energy_update( f3_t* energy, const f3_t* kernel, uz_t pos, f3_t sign )
+{
+    uz_t px = pos & BN_MASK;
+    uz_t py = pos >> BN_BITS;
+    for( uz_t y = 0; y < BN_SIZE; y++ )
+    {
+        const f3_t* krow = kernel + ( ( ( y - py ) & BN_MASK ) << BN_BITS );
+        f3_t* erow = energy + ( y << BN_BITS );
+        for( uz_t x = 0; x < BN_SIZE; x++ ) erow[ x ] += sign * krow[ ( x - px ) & BN_MASK ];
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// position of maximum (cluster) or minimum (void) energy among pattern elements of given value
+static uz_t bn_find( const f3_t* energy, const u0_t* pattern, u0_t value, bl_t cluster )
+{
+    uz_t idx = 0;
+    f3_t e = cluster ? -f3_inf : f3_inf;
+    for( uz_t i = 0; i < BN_AREA; i++ )
+    {
+        if( pattern[ i ] != value ) continue;
+        if( cluster ? ( energy[ i ] > e ) : ( energy[ i ] < e ) )
+        {
+            e = energy[ i ];
+            idx = i;
+        }
+    }
+    return idx;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// computes the blue noise mask via void-and-cluster method (Ulichney 1993)
+static void blue_noise_mask_init( void )
+{
+    static f3_t kernel [ BN_AREA ];
+    static f3_t energy [ BN_AREA ];
+    static f3_t energy0[ BN_AREA ];
+    static u0_t pattern[ BN_AREA ];
+    static u0_t pattern0[ BN_AREA ];
+    static uz_t rank[ BN_AREA ];
+
+    f3_t sigma = 1.5;
+    for( uz_t y = 0; y < BN_SIZE; y++ )
+    {
+        for( uz_t x = 0; x < BN_SIZE; x++ )
+        {
+            f3_t dx = ( x < BN_SIZE - x ) ? x : BN_SIZE - x;
+            f3_t dy = ( y < BN_SIZE - y ) ? y : BN_SIZE - y;
+            kernel[ ( y << BN_BITS ) + x ] = exp( -( dx * dx + dy * dy ) / ( 2.0 * sigma * sigma ) );
+        }
+    }
+
+    // initial pattern: random points
+    bcore_memzero( pattern, sizeof( pattern ) );
+    bcore_memzero( energy,  sizeof( energy  ) );
+    uz_t ones = BN_AREA / 10;
+    u3_t rv = 1234;
+    for( uz_t i = 0; i < ones; i++ )
+    {
+        uz_t pos;
+        do { rv = bcore_lcg00_u3( rv ); pos = ( rv >> 32 ) & ( BN_AREA - 1 ); } while( pattern[ pos ] );
+        pattern[ pos ] = 1;
+        bn_energy_update( energy, kernel, pos, 1 );
+    }
+
+    // moving points from tightest cluster to largest void until stable
+    for( uz_t i = 0; i < BN_AREA; i++ )
+    {
+        uz_t c = bn_find( energy, pattern, 1, true );
+        pattern[ c ] = 0;
+        bn_energy_update( energy, kernel, c, -1 );
+        uz_t v = bn_find( energy, pattern, 0, false );
+        pattern[ v ] = 1;
+        bn_energy_update( energy, kernel, v, 1 );
+        if( v == c ) break;
+    }
+
+    for( uz_t i = 0; i < BN_AREA; i++ )
+    {
+        pattern0[ i ] = pattern[ i ];
+        energy0 [ i ] = energy [ i ];
+    }
+
+    // phase 1: ranking initial points by removing tightest clusters
+    for( uz_t n = ones; n > 0; n-- )
+    {
+        uz_t c = bn_find( energy, pattern, 1, true );
+        pattern[ c ] = 0;
+        bn_energy_update( energy, kernel, c, -1 );
+        rank[ c ] = n - 1;
+    }
+
+    for( uz_t i = 0; i < BN_AREA; i++ )
+    {
+        pattern[ i ] = pattern0[ i ];
+        energy [ i ] = energy0 [ i ];
+    }
+
+    // phase 2: filling largest voids up to half of the area
+    for( uz_t n = ones; n < BN_AREA / 2; n++ )
+    {
+        uz_t v = bn_find( energy, pattern, 0, false );
+        pattern[ v ] = 1;
+        bn_energy_update( energy, kernel, v, 1 );
+        rank[ v ] = n;
+    }
+
+    // phase 3: filling tightest clusters of the minority (zeros)
+    bcore_memzero( energy, sizeof( energy ) );
+    for( uz_t i = 0; i < BN_AREA; i++ ) if( !pattern[ i ] ) bn_energy_update( energy, kernel, i, 1 );
+    for( uz_t n = BN_AREA / 2; n < BN_AREA; n++ )
+    {
+        uz_t c = bn_find( energy, pattern, 0, true );
+        pattern[ c ] = 1;
+        bn_energy_update( energy, kernel, c, -1 );
+        rank[ c ] = n;
+    }
+
+    for( uz_t i = 0; i < BN_AREA; i++ ) blue_noise_mask_g[ i ] = ( rank[ i ] + 0.5 ) / BN_AREA;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline f3_t blue_noise_mask( u2_t x, u2_t y )
+{
+    return blue_noise_mask_g[ ( ( y & BN_MASK ) << BN_BITS ) + ( x & BN_MASK ) ];
+}
+
+/**********************************************************************************************************************/
+/// sobol
+
+static inline u2_t reverse_bits_u2( u2_t x )
+{
+    x = ( ( x >> 1 ) & 0x55555555u ) | ( ( x & 0x55555555u ) << 1 );
+    x = ( ( x >> 2 ) & 0x33333333u ) | ( ( x & 0x33333333u ) << 2 );
+    x = ( ( x >> 4 ) & 0x0F0F0F0Fu ) | ( ( x & 0x0F0F0F0Fu ) << 4 );
+    x = ( ( x >> 8 ) & 0x00FF00FFu ) | ( ( x & 0x00FF00FFu ) << 8 );
+    return ( x >> 16 ) | ( x << 16 );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// hash-based owen scrambling (Laine & Karras 2011; Burley 2020)
+static inline u2_t nested_uniform_scramble_u2( u2_t x, u2_t seed )
+{
+    x = reverse_bits_u2( x );
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return reverse_bits_u2( x );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// first dimension of sobol sequence (van der Corput)
+static inline u2_t sobol0_u2( u2_t index )
+{
+    return reverse_bits_u2( index );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// second dimension of sobol sequence (direction numbers: v[0] = 2^31; v[i] = v[i-1] ^ ( v[i-1] >> 1 ) )
+static inline u2_t sobol1_u2( u2_t index )
+{
+    u2_t x = 0;
+    for( u2_t v = 0x80000000u; index; index >>= 1, v ^= v >> 1 )
+    {
+        if( index & 1 ) x ^= v;
+    }
+    return x;
+}
+
+/**********************************************************************************************************************/
+/// sampler_s
+
+void sampler_s_init( sampler_s* o, u2_t type, s3_t px, s3_t py, u2_t seed )
+{
+    o->type = type < SAMPLER_TYPES ? type : SAMPLER_RANDOM;
+    o->px = px;
+    o->py = py;
+    o->seed = seed;
+    o->dim = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+sampler_set_s sampler_s_open_at( sampler_s* o, u3_t index )
+{
+    u2_t dim_seed = sampler_hash_u2( o->seed, o->dim++ );
+
+    sampler_set_s set;
+    set.type  = o->type;
+    set.seed  = sampler_hash_u2( sampler_hash_u2( dim_seed, o->px ), o->py );
+    set.index = index;
+    set.ox    = 0;
+    set.oy    = 0;
+    crng_s_init( &set.rng, set.seed, o->seed, o->dim );
+    set.rng.ctr = ( u2_t )index * 2;
+    if( set.type == SAMPLER_BLUE_NOISE )
+    {
+        // per-pixel mask lookup; a toroidal shift of the mask per dimension decorrelates dimensions
+        set.ox = blue_noise_mask( o->px + ( dim_seed       ), o->py + ( dim_seed >>  8 ) );
+        set.oy = blue_noise_mask( o->px + ( dim_seed >> 16 ), o->py + ( dim_seed >> 24 ) );
+    }
+    return set;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+v2d_s sampler_set_s_get( sampler_set_s* o )
+{
+    v2d_s v;
+    switch( o->type )
+    {
+        case SAMPLER_SOBOL:
+        {
+            u2_t index = nested_uniform_scramble_u2( o->index++, o->seed );
+            v.x = nested_uniform_scramble_u2( sobol0_u2( index ), sampler_hash_u2( o->seed, 0 ) ) * ( 1.0 / 4294967296.0 );
+            v.y = nested_uniform_scramble_u2( sobol1_u2( index ), sampler_hash_u2( o->seed, 1 ) ) * ( 1.0 / 4294967296.0 );
+        }
+        break;
+
+        case SAMPLER_BLUE_NOISE:
+        {
+            // R2 sequence (Roberts 2018): generalized golden ratio (plastic number) 1.32471795724474602596
+            f3_t index = o->index++;
+            v.x = o->ox + index * 0.75487766624669276005; v.x -= floor( v.x );
+            v.y = o->oy + index * 0.56984029099805326591; v.y -= floor( v.y );
+        }
+        break;
+
+        default:
+        {
+            v.x = crng_s_f3( &o->rng );
+            v.y = crng_s_f3( &o->rng );
+            o->index++;
+        }
+        break;
+    }
+    return v;
+}
+
+/**********************************************************************************************************************/
+
+vd_t sampler_signal_handler( const bcore_signal_s* o )
+{
+    switch( bcore_signal_s_handle_type( o, typeof( "sampler" ) ) )
+    {
+        case TYPEOF_init1:
+        {
+            blue_noise_mask_init();
+        }
+        break;
+
+        default: break;
+    }
+    return NULL;
+}
+
+/**********************************************************************************************************************/
+
@@ -0,0 +1,89 @@
+/** Sample Generators */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** A sampler provides 2D sample points in [0,1)^2 for the stochastic decisions of the renderer.
+ *  Each decision (e.g. sampling a light source at a given surface position) opens a new dimension
+ *  as sampler_set_s, from which the points of that decision are drawn.
+ *  Points of a set are stratified among each other (except for SAMPLER_RANDOM).
+ *  Sets are decorrelated by hashing seed and dimension.
+ */
+
+/// sampler types
+enum
+{
+    SAMPLER_RANDOM = 0,     // counter-based pseudo random numbers
+    SAMPLER_SOBOL,          // owen-scrambled and shuffled sobol (0,2)-sequence (Burley 2020)
+    SAMPLER_BLUE_NOISE,     // rank-1 lattice (R2), rotated by a blue-noise mask value of the pixel; mask shifted per dimension
+    SAMPLER_TYPES
+};
+
+typedef struct sampler_s
+{
+    u2_t type;
+    u2_t seed;
+    u2_t dim;  // next dimension
+    u2_t px;   // pixel position
+    u2_t py;
+} sampler_s;
+
+typedef struct sampler_set_s
+{
+    u2_t type;
+    u2_t seed;
+    u3_t index; // index of next point
+    f3_t ox;    // offset (blue noise)
+    f3_t oy;
+    crng_s rng; // counter-based generator (random)
+} sampler_set_s;
+
+/// hash combining two values
+static inline u2_t sampler_hash_u2( u2_t a, u2_t b )
+{
+    u2_t x = a ^ ( b + 0x9E3779B9u + ( a << 6 ) + ( a >> 2 ) );
+    x ^= x >> 16; x *= 0x7FEB352Du;
+    x ^= x >> 15; x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/// initializes sampler for a pixel; seed should differ among samples of the same pixel
+void sampler_s_init( sampler_s* o, u2_t type, s3_t px, s3_t py, u2_t seed );
+
+/// opens the next dimension; first point is at index
+sampler_set_s sampler_s_open_at( sampler_s* o, u3_t index );
+
+/// opens the next dimension
+static inline sampler_set_s sampler_s_open( sampler_s* o ) { return sampler_s_open_at( o, 0 ); }
+
+/// returns next point of set in [0,1)^2
+v2d_s sampler_set_s_get( sampler_set_s* o );
+
+/**********************************************************************************************************************/
+
+vd_t sampler_signal_handler( const bcore_signal_s* o );
+
+#endif // SAMPLER_H
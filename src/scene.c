@@ -18,6 +18,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "bcore_threads.h"
 #include "bcore_sinks.h"
@@ -35,12 +37,23 @@
 #include "compound.h"
 #include "container.h"
 #include "gmath.h"
+#include "sampler.h"
+#include "irradiance_cache.h"
+#include "photon_map.h"
+#include "occluder_grid.h"
+#include "visibility_cache.h"
+#include "path_guide.h"
+#include "tile_scheduler.h"
+#include "thread_pool.h"
 
 /**********************************************************************************************************************/
 /// globals
 
 bl_t scene_s_overwrite_output_files_g = false;
 bl_t scene_s_automatic_recover_g = false;
+bl_t scene_s_crop_override_g = false;
+uz_t scene_s_crop_g[ 4 ] = { 0, 0, 0, 0 };
+bl_t scene_s_crop_patch_g = false;
 
 /**********************************************************************************************************************/
 /// image_cps_s
@@ -153,7 +166,9 @@ tp_t image_cps_s_hash( const image_cps_s* o )
 typedef struct scene_s
 {
     aware_t _;
-    uz_t threads;
+    uz_t threads;     // render threads; 0: automatic (available CPUs respecting affinity and cgroup quota)
+    uz_t pin_threads; // > 0: binds render threads to CPUs (grouped by NUMA node)
+    uz_t tile_size; // edge length (pixels) of image tiles distributed among threads (see tile_scheduler.h)
     uz_t image_width;
     uz_t image_height;
     f3_t gamma;
@@ -161,6 +176,28 @@ typedef struct scene_s
     uz_t gradient_samples;
     uz_t gradient_cycles;
 
+    /** Crop window: crop_width, crop_height > 0: only the rectangle at (crop_x, crop_y) is rendered.
+     *  crop_patch == 0: output is the cropped image;
+     *  crop_patch >  0: the rectangle is re-rendered into the lum_image of the recovery file (checkpoint), which is updated;
+     *                   output is the full image.
+     */
+    uz_t crop_x;
+    uz_t crop_y;
+    uz_t crop_width;
+    uz_t crop_height;
+    uz_t crop_patch;
+    uz_t save_lum_image; // > 0: the final lum_image is saved to the recovery file (checkpoint for crop_patch)
+
+    uz_t band_height; // > 0: striped mode: the image is rendered and written in horizontal bands of band_height rows
+
+    f3_t adaptive_error;       // > 0: variance driven adaptive sampling (replaces gradient_threshold); target 95% confidence half-width of pixel luminance
+    uz_t adaptive_min_samples; // minimum samples per pixel before its error estimate is trusted (at least 2)
+
+    f3_t progressive_time;     // > 0: progressive mode: gradient cycles continue until this wall clock time (seconds) is used up
+    f3_t progressive_error;    // > 0: progressive mode: gradient cycles continue until the mean relative error is below this value
+    f3_t progressive_interval; // progressive mode: wall clock time (seconds) between intermediate images
+    uz_t progressive_cycles;   // progressive mode: maximum number of gradient cycles (bounds the error target)
+
     cl_s background_color;
 
     v3d_s camera_position;
@@ -174,6 +211,30 @@ typedef struct scene_s
     uz_t direct_samples;
     uz_t path_samples;
     f3_t max_path_length;  // path rays longer than max_path_length obtain background color (only for path tracing; does not apply to reflection)
+    uz_t mis_heuristic;    // multiple importance sampling between direct and path samples (0: off; 1: balance heuristic; 2: power heuristic)
+    uz_t sampler_type;     // SAMPLER_RANDOM, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE (see sampler.h)
+
+    f3_t irradiance_cache_accuracy;    // > 0: caches path traced diffuse illumination (see irradiance_cache.h); typical: 0.1 ... 0.3
+    f3_t irradiance_cache_min_spacing; // minimum radius of a cache record
+    f3_t irradiance_cache_max_spacing; // maximum radius of a cache record
+
+    uz_t caustic_photons;  // > 0: photons emitted per light source for caustics (photon map)
+    f3_t caustic_radius;   // gather radius of caustic photons
+
+    uz_t shadow_crossings; // > 0: shadow rays pass transparent objects (approximation; maximum number of surface crossings)
+
+    uz_t direct_batch;     // > 0: adaptive direct sampling: size of first batch of direct samples
+    f3_t direct_tolerance; // adaptive direct sampling stops after first batch when the fraction of occluded or visible samples is <= direct_tolerance
+
+    f3_t point_light_aperture; // lights with a smaller angular radius (radians) are processed as point lights with a single shadow ray
+
+    uz_t occluder_grid_cells;  // > 0: shadow rays are traced against per light occluder candidates (cells per axis of grid; see occluder_grid.h)
+
+    f3_t visibility_cache_cell_size; // > 0: caches visibility of light sources (opaque shadows) in cells of given size (see visibility_cache.h)
+    f3_t visibility_cache_tolerance; // maximum standard error of a cached visibility
+    uz_t visibility_cache_validate;  // > 0: traces shadow rays also where visibility is cached and reports the deviation
+
+    f3_t path_guide_fraction; // > 0: fraction of path samples drawn from the path guide (see path_guide.h), which is trained after each gradient cycle
 
     compound_s* light;  // light sources
     compound_s* matter; // passive objects
@@ -186,13 +247,32 @@ static sc_t scene_s_def =
 "scene_s = bcore_inst"
 "{"
     "aware_t _;"
-    "uz_t threads = 10;"
+    "uz_t threads = 0;"     // 0: automatic
+    "uz_t pin_threads = 0;"
+    "uz_t tile_size = 16;"
     "uz_t image_width = 800;"
     "uz_t image_height = 600;"
     "f3_t gamma = 1.0;"
     "f3_t gradient_threshold = 0.1;"
     "uz_t gradient_samples = 10;"
     "uz_t gradient_cycles = 1;"
+
+    "uz_t crop_x = 0;"
+    "uz_t crop_y = 0;"
+    "uz_t crop_width  = 0;" // 0: no cropping
+    "uz_t crop_height = 0;"
+    "uz_t crop_patch = 0;"
+    "uz_t save_lum_image = 0;"
+    "uz_t band_height = 0;" // 0: entire image at once
+
+    "f3_t adaptive_error       = 0;" // 0: off (gradient_threshold applies); typical: 0.005 ... 0.02
+    "uz_t adaptive_min_samples = 4;"
+
+    "f3_t progressive_time     = 0;" // 0: no time limit
+    "f3_t progressive_error    = 0;" // 0: no error target; typical: 0.01 ... 0.05
+    "f3_t progressive_interval = 60;"
+    "uz_t progressive_cycles   = 1000;"
+
     "cl_s background_color;"
 
     "v3d_s camera_position;"
@@ -205,6 +285,30 @@ static sc_t scene_s_def =
     "uz_t direct_samples      = 100;"
     "uz_t path_samples        = 0;"  // requires trace_depth > 10
     "f3_t max_path_length     = 1E+30;"  // path rays longer than max_path_length obtain background color
+    "uz_t mis_heuristic       = 2;"  // 0: off; 1: balance heuristic; 2: power heuristic
+    "uz_t sampler_type        = 1;"  // 0: random; 1: sobol; 2: blue noise
+
+    "f3_t irradiance_cache_accuracy    = 0;"  // 0: off
+    "f3_t irradiance_cache_min_spacing = 0.01;"
+    "f3_t irradiance_cache_max_spacing = 1.0;"
+
+    "uz_t caustic_photons = 0;"  // 0: off
+    "f3_t caustic_radius  = 0.02;"
+
+    "uz_t shadow_crossings = 0;" // 0: transparent objects cast full shadows
+
+    "uz_t direct_batch     = 0;" // 0: no adaptive direct sampling
+    "f3_t direct_tolerance = 0;" // 0: all samples of the first batch must agree
+
+    "f3_t point_light_aperture = 0;" // 0: off
+
+    "uz_t occluder_grid_cells = 0;" // 0: off
+
+    "f3_t visibility_cache_cell_size = 0;" // 0: off
+    "f3_t visibility_cache_tolerance = 0.02;"
+    "uz_t visibility_cache_validate  = 0;" // 1: validation mode
+
+    "f3_t path_guide_fraction = 0;" // 0: off; typical: 0.5
 
     "compound_s => light;"
     "compound_s => matter;"
@@ -383,6 +487,78 @@ f3_t scene_s_trans_hit( const scene_s* o, const ray_s* r, trans_data_s* trans )
 
 //----------------------------------------------------------------------------------------------------------------------
 
+/// true if obj is sampled as light source (light sources inside compounds are part of matter)
+bl_t scene_s_is_light_source( const scene_s* o, vc_t obj )
+{
+    for( uz_t i = 0; i < compound_s_get_size( o->light ); i++ )
+    {
+        if( compound_s_get_object( o->light, i ) == obj ) return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Approximate transmission of a shadow ray towards a light source at distance 'length'.
+ *  The ray passes transparent objects along a straight line (no refraction).
+ *  It is attenuated by the fresnel transmission and the residual energy after reflections at each surface
+ *  and by the absorption inside objects.
+ *  Returns black when an opaque object is hit or more than max_crossings surfaces are crossed.
+ */
+cl_s scene_s_shadow_transmission( const scene_s* o, const ray_s* ray, f3_t length, uz_t max_crossings )
+{
+    cl_s transmission = { 1, 1, 1 };
+    ray_s out = *ray;
+    for( uz_t i = 0; i <= max_crossings; i++ )
+    {
+        trans_data_s trans;
+        trans_data_s_init( &trans );
+        f3_t a = compound_s_ray_trans_hit( o->matter, &out, &trans );
+        if( a >= length ) return transmission;
+        if( i == max_crossings ) break;
+
+        if( trans.exit_obj )
+        {
+            transmission.x *= pow( trans.exit_obj->prp.transparency.x, a );
+            transmission.y *= pow( trans.exit_obj->prp.transparency.y, a );
+            transmission.z *= pow( trans.exit_obj->prp.transparency.z, a );
+        }
+
+        f3_t trans_refractive_index = 1.0;
+        f3_t fresnel_reflectivity = 0;
+        f3_t residual = 1.0;
+
+        if( trans.enter_obj )
+        {
+            if( trans.enter_obj->prp.radiance > 0 || v3d_s_sqr( trans.enter_obj->prp.transparency ) == 0 ) break;
+            trans_refractive_index = trans.enter_obj->prp.refractive_index;
+            fresnel_reflectivity   = trans.enter_obj->prp.fresnel_reflectivity && trans.enter_obj->prp.refractive_index != 1.0;
+            residual = ( 1.0 - trans.enter_obj->prp.chromatic_reflectivity ) * ( 1.0 - trans.enter_obj->prp.diffuse_reflectivity );
+        }
+
+        if( trans.exit_obj )
+        {
+            trans_refractive_index /= trans.exit_obj->prp.refractive_index;
+            fresnel_reflectivity = 1.0;
+        }
+
+        if( fresnel_reflectivity > 0 )
+        {
+            v3d_s dir;
+            residual *= 1.0 - fresnel_reflection( out.d, trans.exit_nor, trans_refractive_index, &dir ) * fresnel_reflectivity;
+        }
+
+        transmission = v3d_s_mlf( transmission, residual );
+        if( v3d_s_sqr( transmission ) == 0 ) break;
+
+        out.p = ray_s_pos( &out, a + 2.0 * f3_eps );
+        length -= a + 2.0 * f3_eps;
+    }
+    return cl_black();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 /**********************************************************************************************************************/
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -390,34 +566,256 @@ f3_t scene_s_trans_hit( const scene_s* o, const ray_s* r, trans_data_s* trans )
 /** This function computes a weight according to the Oren-Nayar (1993) reflectance model
  *  using the simplified version.
  *  See http://www1.cs.columbia.edu/CAVE/publications/pdfs/Oren_SIGGRAPH94.pdf for details.
+ *
+ *  weight = cos_r * ( A + B * max( cos_phi, 0 ) * sin( max( theta_i, theta_r ) ) * tan( min( theta_i, theta_r ) ) )
+ *  is evaluated without trigonometric functions:
+ *    cos_phi = -( out_d * ray_prj ) / sin_r  (ray_prj is orthogonal to the surface normal)
+ *    sin( max( theta_i, theta_r ) ) * tan( min( theta_i, theta_r ) ) = sin_i * sin_r / max( cos_i, cos_r )
  */
-f3_t oren_nayar_weight( f3_t weight, f3_t theta_i, f3_t on_a, f3_t on_b, v3d_s out_d, v3d_s nor, v3d_s ray_prj )
+static inline f3_t oren_nayar_weight( f3_t cos_r, f3_t cos_i, f3_t sin_i, f3_t on_a, f3_t on_b, v3d_s out_d, v3d_s ray_prj )
 {
-    /// oren-nayar-reflection
-    f3_t theta_r = acos( weight );
-
     // '-' from negation of ray_projection
-    f3_t cos_phi = -v3d_s_mlv
-    (
-        v3d_s_of_length( v3d_s_orthogonal_projection( out_d, nor ), 1.0 ),
-        ray_prj
-    );
+    return cos_r * ( on_a + on_b * f3_max( -v3d_s_mlv( out_d, ray_prj ), 0 ) * sin_i / f3_max( cos_i, cos_r ) );
+}
 
-    return weight *
-    (
-        on_a +
-        (
-            on_b *
-            f3_max( cos_phi, 0 ) *
-            sin( f3_max( theta_i, theta_r ) ) *
-            tan( f3_min( theta_i, theta_r ) )
-        )
-    );
+//----------------------------------------------------------------------------------------------------------------------
+
+/// GGX roughness of the surface at a transition (0: smooth); the entered object takes precedence
+static inline f3_t trans_data_s_alpha( const trans_data_s* trans )
+{
+    const obj_hdr_s* obj = trans->enter_obj ? trans->enter_obj : trans->exit_obj;
+    return obj ? OBJ_MICROFACET_ALPHA * obj->prp.surface_roughness : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Multiple importance sampling weight (Veach 1997) for a sample of strategy 'a' competing with strategy 'b'.
+ *  fa, fb: Number of samples times probability density of the respective strategy.
+ *  heuristic: 1: balance heuristic; 2: power heuristic (exponent 2)
+ */
+static inline f3_t mis_weight( f3_t fa, f3_t fb, uz_t heuristic )
+{
+    if( heuristic >= 2 )
+    {
+        fa *= fa;
+        fb *= fb;
+    }
+    return ( fa + fb > 0 ) ? fa / ( fa + fb ) : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// statistics of the tracer
+typedef struct tracer_stats_s
+{
+    u3_t direct_estimates;   // number of direct light estimates (per light source and shading point)
+    u3_t direct_samples;     // total number of direct samples
+    u3_t direct_early_exits; // number of estimates stopped after the first batch
+    u3_t occluder_tests;     // number of shadow rays tested against a cached occluder
+    u3_t occluder_hits;      // number of shadow rays occluded by the cached occluder
+    u3_t visibility_reuses;  // number of direct light estimates using cached visibility
+    u3_t visibility_skips;   // number of direct light estimates skipped due to cached visibility 0 (no samples)
+    u3_t visibility_checks;  // validation: number of compared estimates
+    f3_t visibility_dev_sum; // validation: sum of absolute deviations between cached and traced visibility
+    f3_t visibility_dev_max; // validation: maximum absolute deviation
+} tracer_stats_s;
+
+static void tracer_stats_s_add( tracer_stats_s* o, const tracer_stats_s* src )
+{
+    o->direct_estimates   += src->direct_estimates;
+    o->direct_samples     += src->direct_samples;
+    o->direct_early_exits += src->direct_early_exits;
+    o->occluder_tests     += src->occluder_tests;
+    o->occluder_hits      += src->occluder_hits;
+    o->visibility_reuses  += src->visibility_reuses;
+    o->visibility_skips   += src->visibility_skips;
+    o->visibility_checks  += src->visibility_checks;
+    o->visibility_dev_sum += src->visibility_dev_sum;
+    o->visibility_dev_max  = f3_max( o->visibility_dev_max, src->visibility_dev_max );
+}
+
+/// data shared among all tracers
+typedef struct tracer_shared_s
+{
+    irradiance_cache_s* irradiance_cache; // NULL: no irradiance caching
+    photon_map_s*       photon_map;       // caustic photons; NULL: no photon mapping
+    occluder_grid_s*    occluder_grid;    // per light occluder candidates; NULL: shadow rays traverse all matter
+    visibility_cache_s* visibility_cache; // NULL: no visibility caching
+    path_guide_s*       path_guide;       // NULL: no path guiding
+    tracer_stats_s      stats;            // accumulated statistics of finished tracers
+} tracer_shared_s;
+
+/// path states
+enum
+{
+    PATH_CAMERA = 0,   // no diffuse reflection on path so far
+    PATH_DIFFUSE,      // last interaction was a diffuse reflection
+    PATH_TRANSMISSION, // only refractions after a diffuse reflection
+    PATH_CAUSTIC,      // specular interactions after a diffuse reflection (including reflections)
+};
+
+/// per-thread state of the tracer
+typedef struct tracer_s
+{
+    sampler_s sampler;       // sampler of current pixel sample
+    tracer_shared_s* shared;
+    u2_t path_state;         // state of the path reaching the current position
+    tracer_stats_s stats;
+
+    /** Occluder cache: Per light source the object which occluded the most recent shadow ray (NULL: none).
+     *  Nearby shading points are usually shadowed by the same object, which is therefore tested first.
+     */
+    vc_t* last_occluder;
+    uz_t  last_occluder_space;
+
+    /// radiance records for the path guide (flushed when full)
+    path_guide_record_s* guide_buf;
+    uz_t guide_buf_size;
+} tracer_s;
+
+#define TRACER_GUIDE_BUF_SIZE 1024
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void tracer_s_flush_guide_records( tracer_s* o )
+{
+    if( o->guide_buf_size > 0 ) path_guide_s_push( o->shared->path_guide, o->guide_buf, o->guide_buf_size );
+    o->guide_buf_size = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void tracer_s_push_guide_record( tracer_s* o, v3d_s pos, v3d_s dir, f3_t value )
+{
+    if( o->guide_buf_size == TRACER_GUIDE_BUF_SIZE ) tracer_s_flush_guide_records( o );
+    o->guide_buf[ o->guide_buf_size++ ] = ( path_guide_record_s ){ .pos = pos, .dir = dir, .value = value };
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// prepares a persistent tracer for a render job; warm state (occluder cache, buffers) is retained
+static void tracer_s_begin( tracer_s* o, tracer_shared_s* shared, uz_t lights )
+{
+    o->shared = shared;
+    o->path_state = PATH_CAMERA;
+    bcore_memzero( &o->stats, sizeof( o->stats ) );
+
+    if( lights > o->last_occluder_space || !o->last_occluder )
+    {
+        uz_t space = lights > 0 ? lights : 1;
+        o->last_occluder = bcore_alloc( o->last_occluder, sizeof( vc_t ) * space );
+        bcore_memzero( o->last_occluder + o->last_occluder_space, sizeof( vc_t ) * ( space - o->last_occluder_space ) );
+        o->last_occluder_space = space;
+    }
+
+    if( shared->path_guide && !o->guide_buf ) o->guide_buf = bcore_alloc( NULL, sizeof( path_guide_record_s ) * TRACER_GUIDE_BUF_SIZE );
+    o->guide_buf_size = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// hit offset of a ray on an object or compound
+static inline f3_t occluder_ray_hit( vc_t occluder, const ray_s* ray )
+{
+    if( *( const aware_t* )occluder == TYPEOF_compound_s ) return compound_s_ray_hit( occluder, ray, NULL, NULL );
+    return obj_ray_hit( occluder, ray, NULL );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Transmission of a shadow ray towards light source light_index at distance 'length' (black: occluded)
+ *  occluders: candidate occluders of opaque shadows; NULL: all matter objects
+ */
+static cl_s tracer_s_shadow( tracer_s* o, const scene_s* scene, uz_t light_index, const occluder_list_s* occluders, const ray_s* ray, f3_t length, uz_t shadow_crossings )
+{
+    if( shadow_crossings > 0 ) return scene_s_shadow_transmission( scene, ray, length, shadow_crossings );
+
+    vc_t* last = &o->last_occluder[ light_index ];
+    if( *last )
+    {
+        o->stats.occluder_tests++;
+        if( occluder_ray_hit( *last, ray ) <= length )
+        {
+            o->stats.occluder_hits++;
+            return cl_black();
+        }
+    }
+
+    vc_t occluder = NULL;
+    if( occluders )
+    {
+        occluder_list_s_occludes( occluders, ray, length, &occluder );
+    }
+    else if( compound_s_ray_hit( scene->matter, ray, NULL, &occluder ) > length )
+    {
+        occluder = NULL;
+    }
+
+    if( !occluder ) return ( cl_s ){ 1, 1, 1 };
+    *last = occluder;
+    return cl_black();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// opaque shadow test for a group of rays towards light source light_index (see compound_s_ray_group_occlusion)
+static void tracer_s_group_occlusion( tracer_s* o, const scene_s* scene, uz_t light_index, const occluder_list_s* occluders, const ray_s* ray, const f3_t* length, bl_t* occluded, uz_t size )
+{
+    vc_t* last = &o->last_occluder[ light_index ];
+    if( *last )
+    {
+        for( uz_t j = 0; j < size; j++ )
+        {
+            if( occluded[ j ] ) continue;
+            o->stats.occluder_tests++;
+            if( occluder_ray_hit( *last, &ray[ j ] ) <= length[ j ] )
+            {
+                occluded[ j ] = true;
+                o->stats.occluder_hits++;
+            }
+        }
+    }
+
+    vc_t occluder[ COMPOUND_GROUP_SIZE ];
+    for( uz_t j = 0; j < size; j++ ) occluder[ j ] = NULL;
+
+    if( occluders )
+    {
+        occluder_list_s_ray_group_occlusion( occluders, ray, length, occluded, occluder, size );
+    }
+    else
+    {
+        compound_s_ray_group_occlusion( scene->matter, ray, length, occluded, occluder, size );
+    }
+
+    for( uz_t j = 0; j < size; j++ ) if( occluder[ j ] ) *last = occluder[ j ];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Visibility cache update after shadow rays of a direct light estimate were traced:
+ *  An unknown visibility is refined; a known visibility is compared with the traced one (validation).
+ */
+static void tracer_s_visibility_update( tracer_s* o, uz_t slot, bl_t known, f3_t visibility, uz_t shadow_visible, uz_t shadow_rays )
+{
+    if( shadow_rays == 0 ) return;
+    if( !known )
+    {
+        visibility_cache_s_add( o->shared->visibility_cache, slot, shadow_visible, shadow_rays );
+    }
+    else
+    {
+        f3_t dev = f3_abs( visibility - ( f3_t )shadow_visible / shadow_rays );
+        o->stats.visibility_checks++;
+        o->stats.visibility_dev_sum += dev;
+        o->stats.visibility_dev_max = f3_max( o->stats.visibility_dev_max, dev );
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
 cl_s scene_s_lum( const scene_s* scene,
+                  tracer_s* tracer,
                   const ray_s* ray,
                   f3_t offs,
                   trans_data_s* trans,
@@ -431,6 +829,19 @@ cl_s scene_s_lum( const scene_s* scene,
 
     if( trans->enter_obj && trans->enter_obj->prp.radiance > 0 )
     {
+        // caustic paths from light sources are covered by the photon map or by transmissive shadow rays
+        if( scene_s_is_light_source( scene, trans->enter_obj ) )
+        {
+            if( tracer->shared->photon_map )
+            {
+                if( tracer->path_state == PATH_TRANSMISSION || tracer->path_state == PATH_CAUSTIC ) return lum;
+            }
+            else if( scene->shadow_crossings > 0 )
+            {
+                if( tracer->path_state == PATH_TRANSMISSION ) return lum;
+            }
+        }
+
         f3_t diff_sqr = v3d_s_diff_sqr( pos, trans->enter_obj->prp.pos );
         f3_t light_intensity = ( diff_sqr > 0 ) ? ( trans->enter_obj->prp.radiance / diff_sqr ) : f3_mag;
         return v3d_s_mlf( obj_color( trans->enter_obj, pos ), light_intensity * intensity );
@@ -445,6 +856,11 @@ cl_s scene_s_lum( const scene_s* scene,
 
     bl_t transparent = false;
 
+    // specular interactions below continue the path in reflection_state or refraction_state
+    u2_t path_state = tracer->path_state;
+    u2_t reflection_state = ( path_state == PATH_CAMERA ) ? PATH_CAMERA : PATH_CAUSTIC;
+    u2_t refraction_state = ( path_state == PATH_DIFFUSE || path_state == PATH_TRANSMISSION ) ? PATH_TRANSMISSION : reflection_state;
+
     if( trans->enter_obj )
     {
         trans_refractive_index = trans->enter_obj->prp.refractive_index;
@@ -469,25 +885,38 @@ cl_s scene_s_lum( const scene_s* scene,
         transparent = true;
     }
 
+    /** Rough surface: specular interactions below share one microfacet normal (spec_nor)
+     *  importance sampled from the GGX distribution; ggx_weight accounts for density and shadowing.
+     */
+    f3_t alpha = trans_data_s_alpha( trans );
+    v3d_s spec_nor = trans->exit_nor;
+    if( alpha > 0 && ( fresnel_reflectivity > 0 || chromatic_reflectivity > 0 || transparent ) )
+    {
+        sampler_set_s sample_set = sampler_s_open( &tracer->sampler );
+        spec_nor = ggx_sample_normal( trans->exit_nor, alpha, sampler_set_s_get( &sample_set ) );
+    }
+
     /// fresnel reflection
     if( fresnel_reflectivity > 0 && intensity >= scene->trace_min_intensity )
     {
         ray_s out;
         out.p = pos;
-        f3_t reflectance = fresnel_reflection( ray->d, trans->exit_nor, trans_refractive_index, &out.d ) * fresnel_reflectivity;
+        f3_t reflectance = fresnel_reflection( ray->d, spec_nor, trans_refractive_index, &out.d ) * fresnel_reflectivity;
+        f3_t spec_weight = ( alpha > 0 ) ? ggx_weight( ray->d, out.d, trans->exit_nor, spec_nor, alpha ) : 1.0;
 
         trans_data_s trans_l;
         trans_data_s_init( &trans_l );
 
         f3_t a;
         cl_s lum_l = { 0, 0, 0 };
-        if ( ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
+        if ( spec_weight > 0 && ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
         {
-            lum_l = scene_s_lum( scene, &out, a, &trans_l, depth - 1, reflectance * intensity );
+            tracer->path_state = reflection_state;
+            lum_l = scene_s_lum( scene, tracer, &out, a, &trans_l, depth - 1, reflectance * spec_weight * intensity );
         }
         else
         {
-            lum_l = v3d_s_mlf( scene->background_color, reflectance * intensity );
+            lum_l = v3d_s_mlf( scene->background_color, reflectance * spec_weight * intensity );
         }
         lum = v3d_s_add( lum, lum_l );
 
@@ -499,18 +928,20 @@ cl_s scene_s_lum( const scene_s* scene,
     {
         ray_s out;
         out.p = pos;
-        out.d = v3d_s_reflection( ray->d, trans->exit_nor );
+        out.d = v3d_s_reflection( ray->d, spec_nor );
+        f3_t spec_weight = ( alpha > 0 ) ? ggx_weight( ray->d, out.d, trans->exit_nor, spec_nor, alpha ) : 1.0;
         trans_data_s trans_l;
         trans_data_s_init( &trans_l );
         f3_t a;
         cl_s lum_l = { 0, 0, 0 };
-        if ( ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
+        if ( spec_weight > 0 && ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
         {
-            lum_l = scene_s_lum( scene, &out, a, &trans_l, depth - 1, chromatic_reflectivity * intensity );
+            tracer->path_state = reflection_state;
+            lum_l = scene_s_lum( scene, tracer, &out, a, &trans_l, depth - 1, chromatic_reflectivity * spec_weight * intensity );
         }
         else
         {
-            lum_l = v3d_s_mlf( scene->background_color, chromatic_reflectivity * intensity );
+            lum_l = v3d_s_mlf( scene->background_color, chromatic_reflectivity * spec_weight * intensity );
         }
 
         cl_s cl = obj_color( trans->enter_obj, pos );
@@ -530,14 +961,65 @@ cl_s scene_s_lum( const scene_s* scene,
         ray_s surface = { .p = pos, .d = v3d_s_neg( trans->exit_nor ) };
 
         /// oren-nayar-reflection
-        f3_t theta_i = acos( -v3d_s_mlv( ray->d, surface.d ) );
+        f3_t cos_i = -v3d_s_mlv( ray->d, surface.d );
+        f3_t sin_i = sqrt( f3_max( 0, 1.0 - cos_i * cos_i ) );
         v3d_s ray_projection = v3d_s_of_length( v3d_s_orthogonal_projection( ray->d, surface.d ), 1.0 );
 
-        /// random seed
-        u3_t rv = v3d_s_random_seed( surface.p, 3294479285 ) + v3d_s_random_seed( surface.d, 3247146734 );
-
         cl_s lum_l = { 0, 0, 0 };
 
+        uz_t direct_samples = scene->direct_samples * diffuse_intensity;
+        direct_samples = ( direct_samples == 0 ) ? 1 : direct_samples;
+
+        bl_t path_tracing = scene->path_samples && depth > 10;
+        uz_t path_samples = 0;
+        if( path_tracing )
+        {
+            path_samples = scene->path_samples * diffuse_intensity;
+            path_samples = ( path_samples == 0 ) ? 1 : path_samples;
+        }
+
+        /** Multiple importance sampling:
+         *  Path samples also account for hitting light sources. Both sampling strategies
+         *  are then weighted according to their probability densities:
+         *    direct samples: 1 / ( 2 * PI * cyl_hgt ) (even distribution over spherical cap)
+         *    path samples  : cos_r / PI               (cosine-weighted distribution)
+         */
+        uz_t mis_heuristic = path_tracing ? scene->mis_heuristic : 0;
+
+        /** Adaptive direct sampling: After a first batch of direct_batch samples, sampling stops when
+         *  the fraction of visible (or occluded) samples is within direct_tolerance.
+         *  Note: MIS weights are based on the nominal number of direct samples.
+         */
+        uz_t direct_batch = ( scene->direct_batch < direct_samples ) ? scene->direct_batch : 0;
+
+        // transmissive shadow rays (the photon map takes precedence)
+        uz_t shadow_crossings = tracer->shared->photon_map ? 0 : scene->shadow_crossings;
+
+        // lights with fov_to_src.cos_rs >= point_light_cos are processed as point lights
+        f3_t point_light_cos = ( scene->point_light_aperture > 0 ) ? cos( scene->point_light_aperture ) : 2.0;
+
+        /** Irradiance caching of path traced illumination:
+         *  Only for lambertian surfaces (the oren-nayar term depends on the view direction).
+         *  Cached illumination must not contain direct light, which is therefore excluded from multiple importance sampling.
+         */
+        irradiance_cache_s* irr_cache = ( path_tracing && on_b == 0 ) ? tracer->shared->irradiance_cache : NULL;
+        if( irr_cache ) mis_heuristic = 0;
+
+        /** Visibility caching: Where the fraction of unoccluded shadow rays towards a light source is known
+         *  for the cell of pos, the estimate is computed without shadow rays and scaled by that fraction.
+         *  Only for opaque shadows.
+         */
+        visibility_cache_s* vis_cache = ( shadow_crossings == 0 ) ? tracer->shared->visibility_cache : NULL;
+
+        /** Path guiding: A fraction of the path samples is drawn from the learned distribution of incident radiance.
+         *  Both strategies are combined by their mixture density (one-sample MIS), which also serves as path density
+         *  in the MIS weights of direct samples.
+         *  The fraction is limited so that the cosine-weighted strategy retains all directions.
+         */
+        path_guide_s* guide = path_tracing ? tracer->shared->path_guide : NULL;
+        uz_t guide_dist = guide ? path_guide_s_dist( guide, pos ) : PATH_GUIDE_NONE;
+        f3_t guide_fraction = ( guide_dist != PATH_GUIDE_NONE ) ? f3_min( scene->path_guide_fraction, 0.9 ) : 0;
+
         /// process sources with radiance directly  (light-sources)
         for( uz_t i = 0; i < compound_s_get_size( scene->light ); i++ )
         {
@@ -550,74 +1032,314 @@ cl_s scene_s_lum( const scene_s* scene,
             m3d_s src_con = m3d_s_transposed( m3d_s_con_z( fov_to_src.ray.d ) );
             f3_t cyl_hgt = areal_coverage( fov_to_src.cos_rs );
             cl_s color = obj_color( light_src, light_src->prp.pos );
-            uz_t direct_samples = scene->direct_samples * diffuse_intensity;
-            direct_samples = ( direct_samples == 0 ) ? 1 : direct_samples;
+            f3_t direct_density = direct_samples / ( 2.0 * M_PI * cyl_hgt );
+            sampler_set_s sample_set = sampler_s_open( &tracer->sampler );
 
-            for( uz_t j = 0; j < direct_samples; j++ )
+            occluder_list_s occluder_list;
+            const occluder_list_s* occluders = NULL;
+            if( tracer->shared->occluder_grid && occluder_grid_s_get( tracer->shared->occluder_grid, i, pos, &occluder_list ) )
             {
-                out.d = m3d_s_mlv( &src_con, v3d_s_random_sphere_cap( &rv, cyl_hgt ) );
-                f3_t weight = v3d_s_mlv( out.d, surface.d );
+                occluders = &occluder_list;
+            }
 
-                if( weight <= 0 ) continue;
+            uz_t vis_slot = VISIBILITY_CACHE_NONE;
+            f3_t vis_cached = 1.0;
+            bl_t vis_known = false;
+            if( vis_cache )
+            {
+                vis_slot = visibility_cache_s_slot( vis_cache, pos, surface.d, i );
+                vis_known = visibility_cache_s_get( vis_cache, vis_slot, &vis_cached );
+                if( vis_known ) tracer->stats.visibility_reuses++;
+            }
+            bl_t trace_shadows = !vis_known || scene->visibility_cache_validate;
+            if( !trace_shadows && vis_cached == 0 )
+            {
+                // the estimate is resolved by the cache without samples
+                tracer->stats.direct_estimates++;
+                tracer->stats.visibility_skips++;
+                continue;
+            }
 
+            /** Point-light fast path: Samples across a tiny cone are nearly identical.
+             *  A single shadow ray towards the light's center represents the entire cone.
+             *  Path samples do not compete (MIS) with this estimate.
+             */
+            if( fov_to_src.cos_rs >= point_light_cos )
+            {
+                out.d = fov_to_src.ray.d;
+                f3_t weight = v3d_s_mlv( out.d, surface.d );
+                if( weight <= 0 ) continue;
 
                 f3_t a = obj_ray_hit( light_src, &out, NULL );
-                if( a >= f3_inf ) continue;
+                if( a < f3_inf )
+                {
+                    cl_s transmission = ( cl_s ){ 1, 1, 1 };
+                    if( trace_shadows )
+                    {
+                        transmission = tracer_s_shadow( tracer, scene, i, occluders, &out, a, shadow_crossings );
+                        if( vis_cache ) tracer_s_visibility_update( tracer, vis_slot, vis_known, vis_cached, v3d_s_sqr( transmission ) > 0, 1 );
+                    }
+                    if( vis_known ) transmission = ( cl_s ){ vis_cached, vis_cached, vis_cached };
 
-                if( on_b > 0 ) weight = oren_nayar_weight( weight, theta_i, on_a, on_b, out.d, surface.d, ray_projection );
+                    if( v3d_s_sqr( transmission ) > 0 )
+                    {
+                        if( on_b > 0 ) weight = oren_nayar_weight( weight, cos_i, sin_i, on_a, on_b, out.d, ray_projection );
+                        v3d_s hit_pos = ray_s_pos( &out, a );
+                        f3_t diff_sqr = v3d_s_diff_sqr( hit_pos, light_src->prp.pos );
+                        f3_t local_intensity = ( diff_sqr > 0 ) ? ( light_src->prp.radiance / diff_sqr ) : f3_mag;
+
+                        // factor 2 * cyl_hgt: solid angle of cone / PI
+                        cl_s cl = v3d_s_mlf( color, local_intensity * weight * diffuse_intensity * 2.0 * cyl_hgt );
+                        cl.x *= transmission.x;
+                        cl.y *= transmission.y;
+                        cl.z *= transmission.z;
+                        lum_l = v3d_s_add( lum_l, cl );
+                    }
+                    continue;
+                }
+                // center ray missed the light source (non-convex shape): sampling the cone
+            }
 
-                if( compound_s_ray_hit( scene->matter, &out, NULL, NULL ) > a )
+            uz_t samples = 0;
+            uz_t visible = 0;
+            uz_t shadow_rays = 0;
+            uz_t shadow_visible = 0;
+            while( samples < direct_samples )
+            {
+                // penumbra detection: remaining samples are only spent where visibility is mixed
+                if( direct_batch > 0 && samples == direct_batch )
                 {
-                    v3d_s hit_pos = ray_s_pos( &out, a );
+                    f3_t visibility = ( f3_t )visible / samples;
+                    if( visibility <= scene->direct_tolerance || visibility >= 1.0 - scene->direct_tolerance ) break;
+                }
+
+                /** Samples are processed in batches (structure of arrays):
+                 *  The per-sample stages below are independent lane-parallel loops;
+                 *  shadow rays of a batch are traced as one group.
+                 */
+                uz_t batch_end = ( samples < direct_batch ) ? direct_batch : direct_samples;
+                uz_t size = batch_end - samples;
+                size = ( size > COMPOUND_GROUP_SIZE ) ? COMPOUND_GROUP_SIZE : size;
+
+                v2d_s uv_arr      [ COMPOUND_GROUP_SIZE ];
+                ray_s ray_arr     [ COMPOUND_GROUP_SIZE ];
+                f3_t  cos_r_arr   [ COMPOUND_GROUP_SIZE ];
+                f3_t  length_arr  [ COMPOUND_GROUP_SIZE ];
+                bl_t  occluded_arr[ COMPOUND_GROUP_SIZE ];
+                cl_s  transm_arr  [ COMPOUND_GROUP_SIZE ];
+
+                for( uz_t k = 0; k < size; k++ ) uv_arr[ k ] = sampler_set_s_get( &sample_set );
+
+                // directions
+                for( uz_t k = 0; k < size; k++ )
+                {
+                    ray_arr[ k ].p = pos;
+                    ray_arr[ k ].d = m3d_s_mlv( &src_con, v3d_s_sphere_cap_of_uv( uv_arr[ k ], cyl_hgt ) );
+                    cos_r_arr[ k ] = v3d_s_mlv( ray_arr[ k ].d, surface.d );
+                }
+
+                // light source hits
+                for( uz_t k = 0; k < size; k++ )
+                {
+                    length_arr[ k ] = ( cos_r_arr[ k ] > 0 ) ? obj_ray_hit( light_src, &ray_arr[ k ], NULL ) : f3_inf;
+                    occluded_arr[ k ] = ( length_arr[ k ] >= f3_inf );
+                    transm_arr[ k ] = ( cl_s ){ 1, 1, 1 };
+                }
+
+                // shadows
+                if( shadow_crossings > 0 )
+                {
+                    for( uz_t k = 0; k < size; k++ )
+                    {
+                        if( occluded_arr[ k ] ) continue;
+                        transm_arr[ k ] = scene_s_shadow_transmission( scene, &ray_arr[ k ], length_arr[ k ], shadow_crossings );
+                        occluded_arr[ k ] = ( v3d_s_sqr( transm_arr[ k ] ) == 0 );
+                    }
+                }
+                else if( trace_shadows )
+                {
+                    bl_t lit_arr[ COMPOUND_GROUP_SIZE ];
+                    for( uz_t k = 0; k < size; k++ ) lit_arr[ k ] = !occluded_arr[ k ];
+
+                    tracer_s_group_occlusion( tracer, scene, i, occluders, ray_arr, length_arr, occluded_arr, size );
+
+                    for( uz_t k = 0; k < size; k++ )
+                    {
+                        if( !lit_arr[ k ] ) continue;
+                        shadow_rays++;
+                        shadow_visible += !occluded_arr[ k ];
+                        if( vis_known ) occluded_arr[ k ] = false; // validation: cached visibility applies
+                    }
+                }
+
+                // contributions
+                for( uz_t k = 0; k < size; k++ )
+                {
+                    if( occluded_arr[ k ] ) continue;
+                    visible++;
+
+                    f3_t weight = cos_r_arr[ k ];
+                    f3_t mis = 1.0;
+                    if( mis_heuristic )
+                    {
+                        f3_t path_pdf = ( 1.0 - guide_fraction ) * weight / M_PI;
+                        if( guide_fraction > 0 ) path_pdf += guide_fraction * path_guide_s_pdf( guide, guide_dist, ray_arr[ k ].d );
+                        mis = mis_weight( direct_density, path_samples * path_pdf, mis_heuristic );
+                    }
+
+                    if( on_b > 0 ) weight = oren_nayar_weight( weight, cos_i, sin_i, on_a, on_b, ray_arr[ k ].d, ray_projection );
+
+                    v3d_s hit_pos = ray_s_pos( &ray_arr[ k ], length_arr[ k ] );
                     f3_t diff_sqr = v3d_s_diff_sqr( hit_pos, light_src->prp.pos );
                     f3_t local_intensity = ( diff_sqr > 0 ) ? ( light_src->prp.radiance / diff_sqr ) : f3_mag;
-                    cl_sum = v3d_s_add( cl_sum, v3d_s_mlf( color, local_intensity * weight * diffuse_intensity ) );
+                    cl_s cl = v3d_s_mlf( color, local_intensity * weight * diffuse_intensity * mis );
+                    cl.x *= transm_arr[ k ].x;
+                    cl.y *= transm_arr[ k ].y;
+                    cl.z *= transm_arr[ k ].z;
+                    cl_sum = v3d_s_add( cl_sum, cl );
                 }
+
+                samples += size;
             }
 
+            tracer->stats.direct_estimates++;
+            tracer->stats.direct_samples += samples;
+            if( samples < direct_samples ) tracer->stats.direct_early_exits++;
+
+            if( vis_cache && trace_shadows ) tracer_s_visibility_update( tracer, vis_slot, vis_known, vis_cached, shadow_visible, shadow_rays );
+            if( vis_known ) cl_sum = v3d_s_mlf( cl_sum, vis_cached );
+
             // factor 2 arises from weight distribution across the half-sphere
-            lum_l = v3d_s_add( lum_l, v3d_s_mlf( cl_sum, 2.0 * cyl_hgt / direct_samples ) );
+            lum_l = v3d_s_add( lum_l, v3d_s_mlf( cl_sum, 2.0 * cyl_hgt / samples ) );
 
         }
 
         // path tracing
-        if( scene->path_samples && depth > 10 )
+        cl_s irr;
+        if( irr_cache && irradiance_cache_s_lookup( irr_cache, pos, surface.d, depth, &irr ) )
+        {
+            lum_l = v3d_s_add( lum_l, v3d_s_mlf( irr, diffuse_intensity ) );
+        }
+        else if( path_tracing )
         {
             cl_s cl_sum = { 0, 0, 0 };
+            v3d_s grad_r = { 0, 0, 0 }; // rotational gradients (irradiance caching)
+            v3d_s grad_g = { 0, 0, 0 };
+            v3d_s grad_b = { 0, 0, 0 };
+            f3_t inv_dist_sum = 0;
             ray_s out = surface;
             m3d_s out_con = m3d_s_transposed( m3d_s_con_z( surface.d ) );
 
             f3_t per_energy = v3d_s_sqr( lum_l );
             per_energy = per_energy > 0.01 ? per_energy : 0.01;
 
-            uz_t path_samples = scene->path_samples * diffuse_intensity;
-            path_samples = ( path_samples == 0 ) ? 1 : path_samples;
+            sampler_set_s sample_set = sampler_s_open( &tracer->sampler );
 
             for( uz_t i = 0; i < path_samples; i++ )
             {
-                out.d = m3d_s_mlv( &out_con, v3d_s_random_sphere_cap( &rv, 1.0 ) );
-                f3_t weight = v3d_s_mlv( out.d, surface.d );
-                if( weight <= 0 ) continue;
+                v2d_s uv = sampler_set_s_get( &sample_set );
+                f3_t guide_pdf = 0;
+                if( uv.x < guide_fraction )
+                {
+                    uv.x /= guide_fraction;
+                    out.d = path_guide_s_sample( guide, guide_dist, uv, &guide_pdf );
+                }
+                else
+                {
+                    uv.x = ( uv.x - guide_fraction ) / ( 1.0 - guide_fraction );
+                    out.d = m3d_s_mlv( &out_con, v3d_s_hemisphere_cos_of_uv( uv ) );
+                    if( guide_fraction > 0 ) guide_pdf = path_guide_s_pdf( guide, guide_dist, out.d );
+                }
 
-                if( on_b > 0 ) weight = oren_nayar_weight( weight, theta_i, on_a, on_b, out.d, surface.d, ray_projection );
+                f3_t cos_r = v3d_s_mlv( out.d, surface.d );
+                if( cos_r <= 0 ) continue;
+
+                f3_t pdf = guide_fraction * guide_pdf + ( 1.0 - guide_fraction ) * cos_r / M_PI;
+
+                /** Importance sampling: The cosine term is absorbed by the sample density.
+                 *  The remaining weight is the average cosine (0.5) over the half-sphere,
+                 *  modulated by the oren-nayar-term relative to the lambertian term
+                 *  and by the ratio of cosine-weighted density and actual density.
+                 */
+                f3_t weight = 0.5 * cos_r / ( M_PI * pdf );
+                if( on_b > 0 ) weight *= oren_nayar_weight( cos_r, cos_i, sin_i, on_a, on_b, out.d, ray_projection ) / cos_r;
 
                 trans_data_s trans_l;
                 trans_data_s_init( &trans_l );
-                f3_t a = compound_s_ray_trans_hit( scene->matter, &out, &trans_l );
+                f3_t a = mis_heuristic ? scene_s_trans_hit( scene, &out, &trans_l ) : compound_s_ray_trans_hit( scene->matter, &out, &trans_l );
 
-                if( a < scene->max_path_length )
+                cl_s lum_i;
+                f3_t mis = 1.0;
+                if( mis_heuristic && a < f3_inf && trans_l.enter_obj && scene_s_is_light_source( scene, trans_l.enter_obj ) )
+                {
+                    // light source hit
+                    obj_hdr_s* light_src = trans_l.enter_obj;
+                    ray_cone_s fov_to_src = obj_fov( light_src, pos );
+                    f3_t direct_density = direct_samples / ( 2.0 * M_PI * areal_coverage( fov_to_src.cos_rs ) );
+                    mis = ( fov_to_src.cos_rs >= point_light_cos ) ? 0 : mis_weight( path_samples * pdf, direct_density, mis_heuristic );
+                    v3d_s hit_pos = ray_s_pos( &out, a );
+                    f3_t diff_sqr = v3d_s_diff_sqr( hit_pos, light_src->prp.pos );
+                    f3_t local_intensity = ( diff_sqr > 0 ) ? ( light_src->prp.radiance / diff_sqr ) : f3_mag;
+                    cl_s color = obj_color( light_src, light_src->prp.pos );
+                    lum_i = v3d_s_mlf( color, local_intensity * weight * diffuse_intensity * mis );
+                }
+                else if( a < scene->max_path_length )
                 {
-                    cl_s lum = scene_s_lum( scene, &out, a, &trans_l, depth - 10, weight * diffuse_intensity );
-                    cl_sum = v3d_s_add( cl_sum, lum );
+                    tracer->path_state = PATH_DIFFUSE;
+                    lum_i = scene_s_lum( scene, tracer, &out, a, &trans_l, depth - 10, weight * diffuse_intensity );
                 }
                 else
                 {
-                    cl_sum = v3d_s_add( cl_sum, v3d_s_mlf( scene->background_color, weight * diffuse_intensity ) );
+                    lum_i = v3d_s_mlf( scene->background_color, weight * diffuse_intensity );
+                }
+                cl_sum = v3d_s_add( cl_sum, lum_i );
+
+                if( guide && mis > 0 )
+                {
+                    // incident radiance (without MIS weight) per density
+                    f3_t scale = weight * diffuse_intensity * mis;
+                    if( scale > 0 ) tracer_s_push_guide_record( tracer, pos, out.d, ( lum_i.x + lum_i.y + lum_i.z ) / ( 3.0 * scale * pdf ) );
+                }
+
+                if( irr_cache )
+                {
+                    /** Rotational gradient (Ward & Heckbert 1992):
+                     *  Tilting the normal by dn changes the cosine of this sample by out.d * dn relative to cos_r.
+                     *  Only the tangential part of out.d contributes to first order.
+                     */
+                    v3d_s v = v3d_s_mlf( v3d_s_sub( out.d, v3d_s_mlf( surface.d, cos_r ) ), 1.0 / f3_max( cos_r, 0.1 ) );
+                    grad_r = v3d_s_add( grad_r, v3d_s_mlf( v, lum_i.x ) );
+                    grad_g = v3d_s_add( grad_g, v3d_s_mlf( v, lum_i.y ) );
+                    grad_b = v3d_s_add( grad_b, v3d_s_mlf( v, lum_i.z ) );
+                    inv_dist_sum += ( a < f3_inf ) ? 1.0 / f3_max( a, f3_eps ) : 0;
                 }
             }
 
             // factor 2 arises from weight distribution across the half-sphere
             lum_l = v3d_s_add( lum_l, v3d_s_mlf( cl_sum, 2.0 / path_samples ) );
+
+            if( irr_cache && diffuse_intensity > 0 )
+            {
+                f3_t f = 2.0 / ( path_samples * diffuse_intensity );
+                irc_record_s rec;
+                rec.pos    = pos;
+                rec.nor    = surface.d;
+                rec.irr    = v3d_s_mlf( cl_sum, f );
+                rec.grad_r = v3d_s_mlf( grad_r, f );
+                rec.grad_g = v3d_s_mlf( grad_g, f );
+                rec.grad_b = v3d_s_mlf( grad_b, f );
+                rec.radius = irradiance_cache_s_clamp_radius( irr_cache, inv_dist_sum > 0 ? path_samples / inv_dist_sum : f3_inf );
+                rec.depth  = depth;
+                rec.next   = 0;
+                irradiance_cache_s_insert( irr_cache, &rec );
+            }
+        }
+
+        /// caustics
+        if( tracer->shared->photon_map )
+        {
+            cl_s caustic = photon_map_s_irradiance( tracer->shared->photon_map, pos, surface.d, scene->caustic_radius );
+            lum_l = v3d_s_add( lum_l, v3d_s_mlf( caustic, diffuse_intensity / M_PI ) );
         }
 
         cl_s cl = obj_color( trans->enter_obj, pos );
@@ -634,20 +1356,22 @@ cl_s scene_s_lum( const scene_s* scene,
     {
         ray_s out;
         out.p = ray_s_pos( ray, offs + 2.0 * f3_eps );
-        fresnel_refraction( ray->d, trans->exit_nor, trans_refractive_index, &out.d );
+        fresnel_refraction( ray->d, spec_nor, trans_refractive_index, &out.d );
+        f3_t spec_weight = ( alpha > 0 ) ? ggx_weight( ray->d, out.d, trans->exit_nor, spec_nor, alpha ) : 1.0;
 
         trans_data_s trans_l;
         trans_data_s_init( &trans_l );
 
         f3_t a;
         cl_s lum_l = { 0, 0, 0 };
-        if ( ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
+        if ( spec_weight > 0 && ( a = scene_s_trans_hit( scene, &out, &trans_l ) ) < f3_inf )
         {
-            lum_l = scene_s_lum( scene, &out, a, &trans_l, depth - 1, intensity );
+            tracer->path_state = refraction_state;
+            lum_l = scene_s_lum( scene, tracer, &out, a, &trans_l, depth - 1, spec_weight * intensity );
         }
         else
         {
-            lum_l = v3d_s_mlf( scene->background_color, intensity );
+            lum_l = v3d_s_mlf( scene->background_color, spec_weight * intensity );
         }
         lum = v3d_s_add( lum, lum_l );
     }
@@ -663,6 +1387,7 @@ cl_s scene_s_lum( const scene_s* scene,
         lum.z *= bf;
     }
 
+    tracer->path_state = path_state;
     return lum;
 }
 
@@ -674,7 +1399,256 @@ void scene_s_clear( scene_s* o )
     compound_s_clear( o->matter );
 }
 
-// ---------------------------------------------------------------------------------------------------------------------
+/**********************************************************************************************************************/
+/// caustic photons
+
+/// true if object (or any object of a compound) reflects or transmits specularly
+static bl_t obj_is_specular( vc_t o )
+{
+    if( *( aware_t* )o == TYPEOF_compound_s )
+    {
+        const compound_s* cmp = o;
+        for( uz_t i = 0; i < compound_s_get_size( cmp ); i++ )
+        {
+            if( obj_is_specular( compound_s_get_object( cmp, i ) ) ) return true;
+        }
+        return false;
+    }
+    const obj_hdr_s* hdr = o;
+    return ( hdr->prp.fresnel_reflectivity > 0 && hdr->prp.refractive_index != 1.0 ) ||
+           ( hdr->prp.chromatic_reflectivity > 0 ) ||
+           ( v3d_s_sqr( hdr->prp.transparency ) > 0 );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// weights photon power by the microfacet term; returns false when the photon is absorbed
+static inline bl_t scene_photon_microfacet( cl_s* power, v3d_s dir_i, v3d_s dir_o, v3d_s nor, v3d_s m, f3_t alpha )
+{
+    f3_t w = ggx_weight( dir_i, dir_o, nor, m, alpha );
+    *power = v3d_s_mlf( *power, w );
+    return w > 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Traces a photon through the scene using the material model of scene_s_lum.
+ *  Energy partitions of scene_s_lum are selected randomly (russian roulette).
+ *  The photon is stored at the first diffuse reflection after at least one specular interaction.
+ */
+static void scene_s_trace_photon( const scene_s* o, photon_map_s* map, crng_s* rng, ray_s ray, cl_s power )
+{
+    uz_t specular = 0;
+    for( uz_t depth = o->trace_depth; depth > 0; depth-- )
+    {
+        trans_data_s trans;
+        trans_data_s_init( &trans );
+        f3_t a = compound_s_ray_trans_hit( o->matter, &ray, &trans );
+        if( a >= f3_inf ) return;
+
+        v3d_s pos = ray_s_pos( &ray, a );
+
+        if( trans.exit_obj )
+        {
+            power.x *= pow( trans.exit_obj->prp.transparency.x, a );
+            power.y *= pow( trans.exit_obj->prp.transparency.y, a );
+            power.z *= pow( trans.exit_obj->prp.transparency.z, a );
+        }
+
+        if( trans.enter_obj && trans.enter_obj->prp.radiance > 0 ) return;
+
+        f3_t trans_refractive_index = 1.0;
+        f3_t fresnel_reflectivity = 0;
+        f3_t chromatic_reflectivity = 0;
+        f3_t diffuse_reflectivity = 0;
+        bl_t transparent = false;
+
+        if( trans.enter_obj )
+        {
+            trans_refractive_index = trans.enter_obj->prp.refractive_index;
+            fresnel_reflectivity   = trans.enter_obj->prp.fresnel_reflectivity && trans.enter_obj->prp.refractive_index != 1.0;
+            chromatic_reflectivity = trans.enter_obj->prp.chromatic_reflectivity;
+            diffuse_reflectivity   = trans.enter_obj->prp.diffuse_reflectivity;
+            transparent            = v3d_s_sqr( trans.enter_obj->prp.transparency ) > 0;
+        }
+
+        if( trans.exit_obj )
+        {
+            trans_refractive_index /= trans.exit_obj->prp.refractive_index;
+            fresnel_reflectivity = 1.0;
+            diffuse_reflectivity = chromatic_reflectivity = 0;
+            transparent = true;
+        }
+
+        f3_t u = crng_s_f3( rng );
+        ray_s out = { .p = pos };
+
+        // microfacet normal of rough surface (see scene_s_lum)
+        f3_t alpha = trans_data_s_alpha( &trans );
+        v3d_s spec_nor = trans.exit_nor;
+        if( alpha > 0 ) spec_nor = ggx_sample_normal( trans.exit_nor, alpha, ( v2d_s ){ crng_s_f3( rng ), crng_s_f3( rng ) } );
+
+        /// fresnel reflection
+        if( fresnel_reflectivity > 0 )
+        {
+            f3_t reflectance = fresnel_reflection( ray.d, spec_nor, trans_refractive_index, &out.d ) * fresnel_reflectivity;
+            if( u < reflectance )
+            {
+                if( alpha > 0 && !scene_photon_microfacet( &power, ray.d, out.d, trans.exit_nor, spec_nor, alpha ) ) return;
+                ray = out;
+                specular++;
+                continue;
+            }
+            u = ( u - reflectance ) / ( 1.0 - reflectance );
+        }
+
+        /// chromatic reflection
+        if( chromatic_reflectivity > 0 )
+        {
+            if( u < chromatic_reflectivity )
+            {
+                cl_s cl = obj_color( trans.enter_obj, pos );
+                power.x *= cl.x;
+                power.y *= cl.y;
+                power.z *= cl.z;
+                out.d = v3d_s_reflection( ray.d, spec_nor );
+                if( alpha > 0 && !scene_photon_microfacet( &power, ray.d, out.d, trans.exit_nor, spec_nor, alpha ) ) return;
+                ray = out;
+                specular++;
+                continue;
+            }
+            u = ( u - chromatic_reflectivity ) / ( 1.0 - chromatic_reflectivity );
+        }
+
+        /// diffuse reflection
+        if( diffuse_reflectivity > 0 )
+        {
+            if( u < diffuse_reflectivity )
+            {
+                if( specular > 0 ) photon_map_s_push( map, pos, ray.d, power );
+                return;
+            }
+        }
+
+        /// refraction
+        if( transparent )
+        {
+            out.p = ray_s_pos( &ray, a + 2.0 * f3_eps );
+            fresnel_refraction( ray.d, spec_nor, trans_refractive_index, &out.d );
+            if( alpha > 0 && !scene_photon_microfacet( &power, ray.d, out.d, trans.exit_nor, spec_nor, alpha ) ) return;
+            ray = out;
+            specular++;
+            continue;
+        }
+
+        return;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Emits caustic photons from all light sources.
+ *  Photons are emitted only towards specular objects (cones of their field of view) in numbers
+ *  proportional to the cone's solid angle. Overlapping cones are accounted for by the balance heuristic.
+ *  A light source of radiance r emits PI * r per steradian (see scene_s_lum).
+ */
+static void scene_s_trace_photons( const scene_s* o, photon_map_s* map )
+{
+    uz_t size = compound_s_get_size( o->matter );
+    ray_cone_s* cone_arr = bcore_u_alloc( sizeof( ray_cone_s ), NULL, size + 1, NULL );
+    uz_t*     count_arr = bcore_u_alloc( sizeof( uz_t ),       NULL, size + 1, NULL );
+
+    for( uz_t i = 0; i < compound_s_get_size( o->light ); i++ )
+    {
+        const obj_hdr_s* light_src = ( const obj_hdr_s* )compound_s_get_object( o->light, i );
+        v3d_s src_pos = light_src->prp.pos;
+
+        uz_t cones = 0;
+        bl_t full_sphere = false;
+        for( uz_t j = 0; j < size; j++ )
+        {
+            vc_t obj = compound_s_get_object( o->matter, j );
+            if( !obj_is_specular( obj ) ) continue;
+            if( *( aware_t* )obj == TYPEOF_compound_s )
+            {
+                full_sphere = true; // compounds have no field of view
+                break;
+            }
+            cone_arr[ cones++ ] = obj_fov( obj, src_pos );
+        }
+
+        if( full_sphere )
+        {
+            cone_arr[ 0 ].ray.p = src_pos;
+            cone_arr[ 0 ].ray.d = ( v3d_s ){ 0, 0, 1 };
+            cone_arr[ 0 ].cos_rs = -1.0;
+            cones = 1;
+        }
+
+        f3_t h_sum = 0;
+        for( uz_t j = 0; j < cones; j++ ) h_sum += areal_coverage( cone_arr[ j ].cos_rs );
+        if( h_sum <= 0 ) continue;
+
+        for( uz_t j = 0; j < cones; j++ )
+        {
+            count_arr[ j ] = o->caustic_photons * areal_coverage( cone_arr[ j ].cos_rs ) / h_sum + 0.5;
+        }
+
+        cl_s color = obj_color( light_src, src_pos );
+        crng_s rng;
+        crng_s_init( &rng, i, o->caustic_photons, 0x9A3F );
+
+        for( uz_t j = 0; j < cones; j++ )
+        {
+            f3_t cyl_hgt = areal_coverage( cone_arr[ j ].cos_rs );
+            m3d_s src_con = m3d_s_transposed( m3d_s_con_z( cone_arr[ j ].ray.d ) );
+            for( uz_t k = 0; k < count_arr[ j ]; k++ )
+            {
+                ray_s ray = { .p = src_pos, .d = m3d_s_mlv( &src_con, v3d_s_crng_sphere_cap( &rng, cyl_hgt ) ) };
+
+                // sample density of all cones covering ray.d
+                f3_t density = 0;
+                for( uz_t l = 0; l < cones; l++ )
+                {
+                    if( l == j || v3d_s_mlv( ray.d, cone_arr[ l ].ray.d ) >= cone_arr[ l ].cos_rs )
+                    {
+                        density += count_arr[ l ] / ( 2.0 * M_PI * areal_coverage( cone_arr[ l ].cos_rs ) );
+                    }
+                }
+
+                scene_s_trace_photon( o, map, &rng, ray, v3d_s_mlf( color, M_PI * light_src->prp.radiance / density ) );
+            }
+        }
+    }
+
+    bcore_free( count_arr );
+    bcore_free( cone_arr );
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**********************************************************************************************************************/
+
+/// pixel rectangle [x0, x1) x [y0, y1)
+typedef struct pixel_rect_s
+{
+    uz_t x0, y0, x1, y1;
+} pixel_rect_s;
+
+/// intersection of rectangle with image area
+static inline pixel_rect_s pixel_rect_s_clip( pixel_rect_s o, uz_t width, uz_t height )
+{
+    if( o.x1 > width  ) o.x1 = width;
+    if( o.y1 > height ) o.y1 = height;
+    if( o.x0 > o.x1   ) o.x0 = o.x1;
+    if( o.y0 > o.y1   ) o.y0 = o.y1;
+    return o;
+}
+
+static inline uz_t pixel_rect_s_area( const pixel_rect_s* o )
+{
+    return ( o->x1 - o->x0 ) * ( o->y1 - o->y0 );
+}
 
 /**********************************************************************************************************************/
 
@@ -684,12 +1658,13 @@ typedef struct lum_s
     v2d_s pos;
     cl_s  clr;
     f3_t  weight;
+    f3_t  sqr; // sum of squared sample luminances (variance estimation)
 } lum_s;
 
 //----------------------------------------------------------------------------------------------------------------------
 
 BCORE_DEFINE_FUNCTIONS_OBJ_INST( lum_s )
-BCORE_DEFINE_CREATE_SELF( lum_s,  "lum_s = bcore_inst { v2d_s pos; cl_s clr; f3_t weight = 1.0; }" )
+BCORE_DEFINE_CREATE_SELF( lum_s,  "lum_s = bcore_inst { v2d_s pos; cl_s clr; f3_t weight = 1.0; f3_t sqr; }" )
 
 tp_t lum_s_key( const lum_s* o )
 {
@@ -702,12 +1677,14 @@ tp_t lum_s_key( const lum_s* o )
 
 lum_s lum_s_add( const lum_s* o1, const lum_s* o2 )
 {
-    lum_s sum;
-    lum_s_init( &sum );
-    sum.pos = v2d_s_add( o1->pos, o2->pos );
-    sum.clr = v3d_s_add( o1->clr, o2->clr );
-    sum.weight = o1->weight + o2->weight;
-    return sum;
+    // no reflective initialization: called concurrently by render threads
+    return ( lum_s )
+    {
+        .pos    = v2d_s_add( o1->pos, o2->pos ),
+        .clr    = v3d_s_add( o1->clr, o2->clr ),
+        .weight = o1->weight + o2->weight,
+        .sqr    = o1->sqr    + o2->sqr
+    };
 }
 
 /**********************************************************************************************************************/
@@ -729,30 +1706,12 @@ typedef struct lum_arr_s
 BCORE_DEFINE_FUNCTIONS_OBJ_INST( lum_arr_s )
 BCORE_DEFINE_CREATE_SELF( lum_arr_s,  "lum_arr_s = bcore_inst { aware_t _; lum_s [] arr; }" )
 
-void lum_arr_s_clear( lum_arr_s* o )
-{
-    bcore_array_a_set_size( (bcore_array*)o, 0 );
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-
 void lum_arr_s_push( lum_arr_s* o, lum_s lum )
 {
     if( o->space == o->size ) bcore_array_a_set_space( (bcore_array*)o, o->space > 0 ? o->space * 2 : 256 );
     o->data[ o->size++ ] = lum;
 }
 
-//----------------------------------------------------------------------------------------------------------------------
-
-/// sets position and initializes other values with defaults
-void lum_arr_s_push_pos( lum_arr_s* o, v2d_s pos )
-{
-    lum_s lum;
-    lum_s_init( &lum );
-    lum.pos = pos;
-    lum_arr_s_push( o, lum );
-}
-
 /**********************************************************************************************************************/
 
 /// image of lum_s
@@ -792,6 +1751,7 @@ void lum_image_s_reset( lum_image_s* o, uz_t width, uz_t height )
         o->arr.data[ i ].clr = ( cl_s ) { 0, 0, 0 };
         o->arr.data[ i ].pos = ( v2d_s ) { 0, 0 };
         o->arr.data[ i ].weight = 0;
+        o->arr.data[ i ].sqr = 0;
     }
     o->width = width;
     o->height = height;
@@ -801,6 +1761,20 @@ void lum_image_s_reset( lum_image_s* o, uz_t width, uz_t height )
 
 //----------------------------------------------------------------------------------------------------------------------
 
+/// clears all samples in rect
+void lum_image_s_clear_rect( lum_image_s* o, const pixel_rect_s* rect )
+{
+    for( uz_t j = rect->y0; j < rect->y1; j++ )
+    {
+        for( uz_t i = rect->x0; i < rect->x1; i++ )
+        {
+            o->arr.data[ j * o->width + i ] = ( lum_s ) { .pos = { 0, 0 }, .clr = { 0, 0, 0 }, .weight = 0, .sqr = 0 };
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 void lum_image_s_push( lum_image_s* o, lum_s lum )
 {
     s2_t x = lum.pos.x / lum.weight;
@@ -814,16 +1788,9 @@ void lum_image_s_push( lum_image_s* o, lum_s lum )
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void lum_image_s_push_arr( lum_image_s* o, const lum_arr_s* lum_arr )
-{
-    for( uz_t i = 0; i < lum_arr->size; i++ ) lum_image_s_push( o, lum_arr->data[ i ] );
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-
 lum_s lum_image_s_get_avg( const lum_image_s* o, s2_t x, s2_t y )
 {
-    lum_s lum = { .pos = { 0, 0 }, .clr = { 0, 0, 0 }, .weight = 0 };
+    lum_s lum = { .pos = { 0, 0 }, .clr = { 0, 0, 0 }, .weight = 0, .sqr = 0 };
     if( x >= 0 && x < o->width && y >= 0 && y < o->height )
     {
         uz_t idx = y * o->width + x;
@@ -831,7 +1798,49 @@ lum_s lum_image_s_get_avg( const lum_image_s* o, s2_t x, s2_t y )
     }
 
     f3_t f = ( lum.weight > 0 ) ? 1.0 / lum.weight : 1.0;
-    return ( lum_s ) { .pos = v2d_s_mlf( lum.pos, f ), .clr = v3d_s_mlf( lum.clr, f ), .weight = 1.0 };
+    return ( lum_s ) { .pos = v2d_s_mlf( lum.pos, f ), .clr = v3d_s_mlf( lum.clr, f ), .weight = 1.0, .sqr = lum.sqr * f };
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// luminance of a (saturated) sample color
+static inline f3_t lum_luminance( cl_s clr )
+{
+    return ( clr.x + clr.y + clr.z ) * ( 1.0 / 3.0 );
+}
+
+/** Estimated error of the luminance of pixel (x,y): half-width of its 95% confidence interval
+ *  ( 1.96 * standard error of the mean ). Returns f3_inf for less than two samples.
+ */
+f3_t lum_image_s_error( const lum_image_s* o, s3_t x, s3_t y )
+{
+    const lum_s* lum = &o->arr.data[ y * o->width + x ];
+    f3_t n = lum->weight;
+    if( n < 2 ) return f3_inf;
+    f3_t mean = lum_luminance( lum->clr ) / n;
+    f3_t var = f3_max( 0, ( lum->sqr - n * mean * mean ) / ( n - 1 ) );
+    return 1.96 * sqrt( var / n );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// mean error (lum_image_s_error) in rect relative to mean luminance; pixels with less than two samples are ignored
+f3_t lum_image_s_mean_relative_error( const lum_image_s* o, const pixel_rect_s* rect )
+{
+    f3_t error_sum = 0;
+    f3_t lum_sum = 0;
+    for( uz_t j = rect->y0; j < rect->y1; j++ )
+    {
+        for( uz_t i = rect->x0; i < rect->x1; i++ )
+        {
+            f3_t error = lum_image_s_error( o, i, j );
+            if( error == f3_inf ) continue;
+            const lum_s* lum = &o->arr.data[ j * o->width + i ];
+            error_sum += error;
+            lum_sum += lum_luminance( lum->clr ) / lum->weight;
+        }
+    }
+    return ( lum_sum > 0 ) ? error_sum / lum_sum : f3_inf;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -840,6 +1849,7 @@ f3_t lum_image_s_clr_dev( const lum_image_s* o, v3d_s ref, s3_t x, s3_t y )
 {
     if( x < 0 || x >= o->width  ) return 0;
     if( y < 0 || y >= o->height ) return 0;
+    if( o->arr.data[ y * o->width + x ].weight == 0 ) return 0; // not rendered (e.g. outside crop window)
     return v3d_s_sqr( v3d_s_sub( ref, lum_image_s_get_avg( o, x, y ).clr ) );
 }
 
@@ -863,17 +1873,64 @@ f3_t lum_image_s_sqr_grad( const lum_image_s* o, s3_t x, s3_t y )
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void lum_image_s_create_image_file( const lum_image_s* o, sc_t file )
+/// prints achieved samples per pixel in rect; adaptive_error > 0: also the fraction of converged pixels
+void lum_image_s_print_sample_stats( const lum_image_s* o, const pixel_rect_s* rect, f3_t adaptive_error )
+{
+    uz_t pixels = pixel_rect_s_area( rect );
+    if( pixels == 0 ) return;
+
+    f3_t min = f3_inf;
+    f3_t max = 0;
+    f3_t sum = 0;
+    f3_t error_sum = 0;
+    uz_t converged = 0;
+    for( uz_t j = rect->y0; j < rect->y1; j++ )
+    {
+        for( uz_t i = rect->x0; i < rect->x1; i++ )
+        {
+            f3_t n = o->arr.data[ j * o->width + i ].weight;
+            min = f3_min( min, n );
+            max = f3_max( max, n );
+            sum += n;
+            if( adaptive_error > 0 )
+            {
+                f3_t error = lum_image_s_error( o, i, j );
+                if( error <= adaptive_error ) converged++;
+                if( error < f3_inf ) error_sum += error;
+            }
+        }
+    }
+
+    bcore_msg( "Samples per pixel: min %g; mean %5.3g; max %g\n", min, sum / pixels, max );
+    if( adaptive_error > 0 )
+    {
+        bcore_msg
+        (
+            "Adaptive sampling: %5.3g%% of pixels converged; mean error %5.3g (target %5.3g)\n",
+            ( 100.0 * converged ) / pixels,
+            error_sum / pixels,
+            adaptive_error
+        );
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// writes the image of rect (NULL: entire image)
+void lum_image_s_create_image_file( const lum_image_s* o, const pixel_rect_s* rect, sc_t file )
 {
+    pixel_rect_s full = { 0, 0, o->width, o->height };
+    if( !rect ) rect = &full;
+
     image_cl_s* image = image_cl_s_create();
-    image_cl_s_set_size( image, o->width, o->height, cl_black() );
+    image_cl_s_set_size( image, rect->x1 - rect->x0, rect->y1 - rect->y0, cl_black() );
     image_cps_s* image_cps = image_cps_s_create();
 
-    for( uz_t j = 0; j < o->height; j++ )
+    for( uz_t j = rect->y0; j < rect->y1; j++ )
     {
-        for( uz_t i = 0; i < o->width; i++ )
+        for( uz_t i = rect->x0; i < rect->x1; i++ )
         {
-            image_cl_s_set_pixel( image, i, j, lum_image_s_get_avg( o, i, j ).clr );
+            image_cl_s_set_pixel( image, i - rect->x0, j - rect->y0, lum_image_s_get_avg( o, i, j ).clr );
         }
     }
     image_cps_s_copy_cl( image_cps, image );
@@ -884,6 +1941,64 @@ void lum_image_s_create_image_file( const lum_image_s* o, sc_t file )
     image_cl_s_discard( image );
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+
+/// streamed PNM output: rows are written as they are finished
+typedef struct image_pnm_stream_s
+{
+    vd_t sink;
+    tp_t hash; // same as image_cps_s_hash of the entire image
+    uz_t width;
+    uz_t height;
+    uz_t rows; // rows written so far
+} image_pnm_stream_s;
+
+void image_pnm_stream_s_open( image_pnm_stream_s* o, sc_t file, uz_t width, uz_t height )
+{
+    o->sink = bcore_sink_open_file( file );
+    o->hash = bcore_tp_init();
+    o->width = width;
+    o->height = height;
+    o->rows = 0;
+    bcore_sink_a_push_fa( o->sink, "P6\n#<uz_t> #<uz_t>\n255\n", width, height );
+}
+
+/// fills the remaining rows with black, so that the file matches its header
+void image_pnm_stream_s_pad( image_pnm_stream_s* o )
+{
+    u0_t c[ 3 ] = { 0, 0, 0 };
+    for( ; o->rows < o->height; o->rows++ )
+    {
+        for( uz_t i = 0; i < o->width; i++ ) bcore_sink_a_push_data( o->sink, c, 3 );
+    }
+}
+
+void image_pnm_stream_s_close( image_pnm_stream_s* o )
+{
+    bcore_inst_a_discard( o->sink );
+    o->sink = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// appends rows y0 ... y1 - 1 of o to stream
+void lum_image_s_stream_rows( const lum_image_s* o, image_pnm_stream_s* stream, uz_t y0, uz_t y1 )
+{
+    for( uz_t j = y0; j < y1; j++ )
+    {
+        for( uz_t i = 0; i < o->width; i++ )
+        {
+            u2_t v = cps_from_cl( lum_image_s_get_avg( o, i, j ).clr );
+            stream->hash = bcore_tp_fold_u2( stream->hash, v );
+            u0_t c;
+            c = r_from_cps( v ); bcore_sink_a_push_data( stream->sink, &c, 1 );
+            c = g_from_cps( v ); bcore_sink_a_push_data( stream->sink, &c, 1 );
+            c = b_from_cps( v ); bcore_sink_a_push_data( stream->sink, &c, 1 );
+        }
+        stream->rows++;
+    }
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**********************************************************************************************************************/
@@ -903,11 +2018,153 @@ static void signal_callabck( int signal_received )
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+/** Render threads persist over gradient cycles and images until the scene module shuts down.
+ *  Each worker keeps its tracer (occluder cache, buffers) between jobs.
+ */
+static thread_pool_s* render_pool_g = NULL;
+static tracer_s*      render_tracer_arr_g = NULL;
+static uz_t           render_tracers_g = 0;
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// provides pool and tracers for workers [0, workers); must not be called during a job
+static void render_pool_reserve( uz_t workers )
+{
+    if( !render_pool_g ) render_pool_g = thread_pool_s_create();
+    if( workers > render_tracers_g )
+    {
+        render_tracer_arr_g = bcore_alloc( render_tracer_arr_g, sizeof( tracer_s ) * workers );
+        bcore_memzero( render_tracer_arr_g + render_tracers_g, sizeof( tracer_s ) * ( workers - render_tracers_g ) );
+        render_tracers_g = workers;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// clears per-worker caches referring to objects of a previous image; must not be called during a job
+static void render_pool_reset( void )
+{
+    for( uz_t i = 0; i < render_tracers_g; i++ )
+    {
+        tracer_s* tracer = &render_tracer_arr_g[ i ];
+        if( tracer->last_occluder ) bcore_memzero( tracer->last_occluder, sizeof( vc_t ) * tracer->last_occluder_space );
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+static void render_pool_down( void )
+{
+    thread_pool_s_discard( render_pool_g );
+    render_pool_g = NULL;
+    for( uz_t i = 0; i < render_tracers_g; i++ )
+    {
+        tracer_s* tracer = &render_tracer_arr_g[ i ];
+        if( tracer->last_occluder ) bcore_free( tracer->last_occluder );
+        if( tracer->guide_buf     ) bcore_free( tracer->guide_buf );
+    }
+    if( render_tracer_arr_g ) bcore_free( render_tracer_arr_g );
+    render_tracer_arr_g = NULL;
+    render_tracers_g = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// wall clock time in seconds (monotonic)
+static f3_t wall_time( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// number of render threads
+static uz_t scene_s_render_threads( const scene_s* o )
+{
+    return o->threads > 0 ? o->threads : thread_pool_auto_size();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/** The lum machine renders the gradient cycles of an image.
+ *  The image is partitioned into tiles of tile_size pixels, which are processed in Morton order.
+ *  A cycle consists of two parallel passes over the tiles:
+ *    1. Gradient evaluation: Selects the pixels to be sampled and counts the samples per tile.
+ *       This determines the range of sample indices of each tile.
+ *       With adaptive_error > 0, the selection is driven by the per-pixel error estimate (lum_image_s_error)
+ *       instead of the neighbour gradient: Pixels whose error is below adaptive_error are converged;
+ *       the others share a budget of gradient_samples per unconverged pixel in proportion to their error.
+ *       This requires a preceding pass summing up the error per tile.
+ *    2. Sampling: A thread claiming a work unit generates its sample positions on the fly, traces them,
+ *       accumulates the results in a tile-local buffer and merges that buffer into cycle_arr.
+ *  When the cycle completes, a third parallel pass merges cycle_arr into lum_image. An interrupted cycle
+ *  (SIGINT) leaves lum_image at the state of the last completed cycle.
+ *  Work units are tiles or, for very expensive tiles, bands of tile rows (see lum_machine_s_plan_units).
+ *  They are dispatched in the order of decreasing predicted cost based on the time per sample measured for
+ *  the tile in the previous cycle. The dispatch order does not affect sample indices, so the result is
+ *  independent of timing.
+ *  Work units cover disjoint pixels, so no pass needs locking.
+ *  Samples are not stored; memory is proportional to the image size.
+ */
+
+/// work units with more than 1 / ( LUM_UNITS_PER_THREAD * threads ) of the predicted cycle cost are split
+#define LUM_UNITS_PER_THREAD 8
+
+/// rows row0 ... row1 - 1 (relative to tile) of tile at Morton position k
+typedef struct lum_unit_s
+{
+    uz_t k;
+    uz_t row0;
+    uz_t row1;
+    uz_t samples;
+    f3_t cost;    // predicted cost
+    f3_t time;    // measured wall clock time (0: not completed)
+} lum_unit_s;
+
 typedef struct lum_machine_s
 {
     const scene_s* scene;
-    lum_arr_s* lum_arr;
-    uz_t index;
+    tracer_shared_s* shared;
+    lum_image_s* lum_image;
+
+    uz_t threads;
+    pixel_rect_s rect; // rendered area (tiles partition rect)
+    uz_t origin_y;     // image row of lum_image row 0 (striped mode)
+    uz_t tile_size;
+    uz_t tiles_x;
+    uz_t tiles_y;
+    uz_t tiles;
+    uz_t* tile_order;    // tile ( ty * tiles_x + tx ) per position in Morton order
+    uz_t* tile_beg;      // per position: first sample index; size: tiles + 1
+    u2_t* pixel_samples; // samples per pixel in current cycle
+    lum_s* cycle_arr;    // per pixel: samples of current cycle (merged into lum_image when the cycle completes)
+    f3_t* tile_error;    // per position: sum of relative errors of unconverged pixels (adaptive_error > 0)
+    uz_t* tile_open;     // per position: number of unconverged pixels (adaptive_error > 0)
+    f3_t* tile_cost;     // per position: measured time per sample (0: unknown)
+
+    lum_unit_s* unit_arr; // work units of current cycle in dispatch order
+    uz_t units;
+    uz_t unit_space;
+    uz_t* unit_beg;       // scheduler ranges: prefix sum of unit weights (predicted cost); size: units + 1
+
+    // load balance statistics
+    uz_t split_units;  // units resulting from split tiles
+    f3_t busy_time;    // sum of unit times
+    f3_t thread_time;  // sum of pass time * threads
+
+    uz_t select_phase; // 0: error summation; 1: selection
+    f3_t error_scale;  // samples per unit of relative error (adaptive_error > 0)
+
+    f3_t deadline; // > 0: wall clock time (see wall_time) after which no further tiles are claimed
+
+    uz_t gradient_cycle;
+    u2_t seed; // sampler seed of current gradient cycle
+    u3_t rval; // random seed of current gradient cycle (SAMPLER_RANDOM)
+    tile_scheduler_s* scheduler;
+    _Atomic uz_t next_tile; // tile claiming during gradient evaluation
+    _Atomic uz_t progress;  // number of processed samples
     bcore_mutex_s mutex;
 } lum_machine_s;
 
@@ -923,6 +2180,16 @@ void lum_machine_s_init( lum_machine_s* o )
 
 void lum_machine_s_down( lum_machine_s* o )
 {
+    tile_scheduler_s_discard( o->scheduler );
+    if( o->tile_order    ) bcore_free( o->tile_order );
+    if( o->tile_beg      ) bcore_free( o->tile_beg );
+    if( o->pixel_samples ) bcore_free( o->pixel_samples );
+    if( o->cycle_arr     ) bcore_free( o->cycle_arr );
+    if( o->tile_error    ) bcore_free( o->tile_error );
+    if( o->tile_open     ) bcore_free( o->tile_open );
+    if( o->tile_cost     ) bcore_free( o->tile_cost );
+    if( o->unit_arr      ) bcore_free( o->unit_arr );
+    if( o->unit_beg      ) bcore_free( o->unit_beg );
     bcore_mutex_s_down( &o->mutex );
 }
 
@@ -931,108 +2198,681 @@ BCORE_DEFINE_FUNCTION_DISCARD( lum_machine_s )
 
 //----------------------------------------------------------------------------------------------------------------------
 
-lum_machine_s* lum_machine_s_plant( const scene_s* scene, lum_arr_s* lum_arr )
+/// rect: rendered area
+lum_machine_s* lum_machine_s_plant( const scene_s* scene, tracer_shared_s* shared, lum_image_s* lum_image, const pixel_rect_s* rect )
 {
     lum_machine_s* o = lum_machine_s_create();
     o->scene = scene;
-    o->lum_arr = lum_arr;
+    o->shared = shared;
+    o->lum_image = lum_image;
+
+    o->threads = scene_s_render_threads( scene );
+    o->tile_size = scene->tile_size > 0 ? scene->tile_size : 1;
+    o->rect = *rect;
+    o->tiles_x = ( ( rect->x1 - rect->x0 ) + o->tile_size - 1 ) / o->tile_size;
+    o->tiles_y = ( ( rect->y1 - rect->y0 ) + o->tile_size - 1 ) / o->tile_size;
+    o->tiles = o->tiles_x * o->tiles_y;
+
+    o->tile_order = bcore_alloc( NULL, sizeof( uz_t ) * ( o->tiles > 0 ? o->tiles : 1 ) );
+    tile_morton_order( o->tiles_x, o->tiles_y, o->tile_order );
+
+    o->tile_beg = bcore_alloc( NULL, sizeof( uz_t ) * ( o->tiles + 1 ) );
+    bcore_memzero( o->tile_beg, sizeof( uz_t ) * ( o->tiles + 1 ) );
+
+    uz_t pixels = lum_image->width * lum_image->height;
+    o->pixel_samples = bcore_alloc( NULL, sizeof( u2_t ) * ( pixels > 0 ? pixels : 1 ) );
+    o->cycle_arr = bcore_alloc( NULL, sizeof( lum_s ) * ( pixels > 0 ? pixels : 1 ) );
+    bcore_memzero( o->cycle_arr, sizeof( lum_s ) * ( pixels > 0 ? pixels : 1 ) );
+
+    o->tile_error = bcore_alloc( NULL, sizeof( f3_t ) * ( o->tiles > 0 ? o->tiles : 1 ) );
+    o->tile_open  = bcore_alloc( NULL, sizeof( uz_t ) * ( o->tiles > 0 ? o->tiles : 1 ) );
+    o->tile_cost  = bcore_alloc( NULL, sizeof( f3_t ) * ( o->tiles > 0 ? o->tiles : 1 ) );
+    bcore_memzero( o->tile_cost, sizeof( f3_t ) * ( o->tiles > 0 ? o->tiles : 1 ) );
+
     return o;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-uz_t lum_machine_s_get_index( lum_machine_s* o )
+/// pixel rectangle [x0, x1) x [y0, y1) of tile at Morton position k
+static void lum_machine_s_tile_rect( const lum_machine_s* o, uz_t k, uz_t* x0, uz_t* y0, uz_t* x1, uz_t* y1 )
 {
-    bcore_mutex_s_lock( &o->mutex );
-    uz_t index = o->index++;
-    if( ( ( index + 1 ) %  5000 ) == 0 ) bcore_msg( "." );
-    if( ( ( index + 1 ) % 50000 ) == 0 ) bcore_msg( "%5.1f%% ", ( 100.0 * index ) / o->lum_arr->size );
-    bcore_mutex_s_unlock( &o->mutex );
-    return index;
+    uz_t t = o->tile_order[ k ];
+    *x0 = o->rect.x0 + ( t % o->tiles_x ) * o->tile_size;
+    *y0 = o->rect.y0 + ( t / o->tiles_x ) * o->tile_size;
+    *x1 = *x0 + o->tile_size; if( *x1 > o->rect.x1 ) *x1 = o->rect.x1;
+    *y1 = *y0 + o->tile_size; if( *y1 > o->rect.y1 ) *y1 = o->rect.y1;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-vd_t lum_machine_s_func( lum_machine_s* o )
+/// true when the deadline has passed (first cycle is always completed)
+static bl_t lum_machine_s_expired( const lum_machine_s* o )
 {
-    uz_t width = o->scene->image_width;
-    uz_t height = o->scene->image_height;
-    uz_t unit_sz = ( height >> 1 );
-    f3_t unit_f = 1.0 / unit_sz;
+    return o->deadline > 0 && o->gradient_cycle > 0 && wall_time() > o->deadline;
+}
 
-    m3d_s camera_rotation;
+//----------------------------------------------------------------------------------------------------------------------
+
+/// accounts for processed samples; prints progress without blocking other threads
+void lum_machine_s_progress( lum_machine_s* o, uz_t count )
+{
+    uz_t done = atomic_fetch_add_explicit( &o->progress, count, memory_order_relaxed );
+    for( uz_t mark = done / 5000 + 1; mark * 5000 <= done + count; mark++ )
     {
-        v3d_s ry = v3d_s_of_length( o->scene->camera_view_direction, 1 );
-        v3d_s rz = v3d_s_of_length( o->scene->camera_top_direction, 1 );
-        rz = v3d_s_von( ry, rz );
-        v3d_s rx = v3d_s_mlx( ry, rz );
-        camera_rotation.x = rx;
+        bcore_msg( "." );
+        if( ( mark % 10 ) == 0 ) bcore_msg( "%5.1f%% ", ( 100.0 * mark * 5000 ) / o->tile_beg[ o->tiles ] );
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Samples of pixel (x,y) in variance driven mode (adaptive_error > 0).
+ *  Pixels below adaptive_min_samples (at least 2) are filled up; converged pixels are skipped.
+ *  Otherwise the pixel receives its share of the budget but not more than the number of samples
+ *  expected to reach the target (the error decreases with the square root of the sample count).
+ *  phase 0: only the relative error is returned in ratio (0 for pixels not competing for the budget).
+ */
+static u2_t lum_machine_s_adaptive_samples( const lum_machine_s* o, uz_t x, uz_t y, f3_t* ratio )
+{
+    *ratio = 0;
+    f3_t n = o->lum_image->arr.data[ y * o->scene->image_width + x ].weight;
+
+    // the error estimate requires at least two samples
+    uz_t min_samples = o->scene->adaptive_min_samples > 2 ? o->scene->adaptive_min_samples : 2;
+    if( n < min_samples ) return min_samples - n;
+
+    f3_t r = lum_image_s_error( o->lum_image, x, y ) / o->scene->adaptive_error;
+    if( r <= 1.0 ) return 0;
+    *ratio = r;
+    if( o->select_phase == 0 ) return 0;
+
+    f3_t needed = ceil( n * ( r * r - 1.0 ) );
+    f3_t share  = floor( o->error_scale * r + 0.5 );
+    f3_t samples = f3_max( 1.0, f3_min( needed, share ) );
+    return f3_min( samples, 0xFFFF );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** pass 1: selects pixels of claimed tiles; tile_beg[ k + 1 ] receives the number of samples of tile k
+ *  In variance driven mode, phase 0 computes tile_error and tile_open instead.
+ */
+void lum_machine_s_select_func( lum_machine_s* o, uz_t worker )
+{
+    uz_t width = o->scene->image_width;
+    f3_t sqr_gradient_threshold = f3_sqr( o->scene->gradient_threshold );
+    uz_t samples = o->scene->gradient_samples;
+    bl_t adaptive = o->scene->adaptive_error > 0;
+
+    uz_t k;
+    while( ( k = atomic_fetch_add_explicit( &o->next_tile, 1, memory_order_relaxed ) ) < o->tiles )
+    {
+        uz_t x0, y0, x1, y1;
+        lum_machine_s_tile_rect( o, k, &x0, &y0, &x1, &y1 );
+
+        uz_t count = 0;
+        uz_t open = 0;
+        f3_t error = 0;
+        for( uz_t j = y0; j < y1; j++ )
+        {
+            for( uz_t i = x0; i < x1; i++ )
+            {
+                u2_t n = 1;
+                if( o->gradient_cycle > 0 )
+                {
+                    if( adaptive )
+                    {
+                        f3_t ratio;
+                        n = lum_machine_s_adaptive_samples( o, i, j, &ratio );
+                        error += ratio;
+                        open += ( ratio > 0 );
+                    }
+                    else
+                    {
+                        n = ( lum_image_s_sqr_grad( o->lum_image, i, j ) > sqr_gradient_threshold ) ? samples : 0;
+                    }
+                }
+                o->pixel_samples[ j * width + i ] = n;
+                count += n;
+            }
+        }
+
+        if( adaptive && o->select_phase == 0 )
+        {
+            o->tile_error[ k ] = error;
+            o->tile_open[ k ] = open;
+        }
+        else
+        {
+            o->tile_beg[ k + 1 ] = count;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// traces the camera ray through image position pos; seed: seeds the sampler
+static cl_s lum_machine_s_trace_sample( const lum_machine_s* o, tracer_s* tracer, const m3d_s* camera_rotation, v2d_s pos, u2_t seed )
+{
+    uz_t width = o->scene->image_width;
+    uz_t height = o->scene->image_height;
+    f3_t unit_f = 1.0 / ( height >> 1 );
+
+    sampler_s_init( &tracer->sampler, o->scene->sampler_type, pos.x, pos.y, seed );
+
+    f3_t z = unit_f * ( ( height >> 1 ) - pos.y );
+    f3_t x = unit_f * ( pos.x - ( width >> 1 ) );
+    v3d_s d = { x, o->scene->camera_focal_length, z };
+    d = v3d_s_of_length( d, 1.0 );
+
+    ray_s ray;
+    ray.p = o->scene->camera_position;
+    ray.d = m3d_s_mlv( camera_rotation, d );
+
+    cl_s out_clr = o->scene->background_color;
+
+    trans_data_s trans_l;
+    trans_data_s_init( &trans_l );
+
+    f3_t offs = scene_s_trans_hit( o->scene, &ray, &trans_l );
+    if( offs < f3_inf )
+    {
+        if( o->scene->experimental_level == 0 )
+        {
+            out_clr = scene_s_lum( o->scene, tracer, &ray, offs, &trans_l, o->scene->trace_depth, 1.0 );
+        }
+        else
+        {
+            bcore_err_fa( "Unsupported experimental level #<s3_t>\n", o->scene->experimental_level );
+        }
+    }
+
+    return cl_s_sat( out_clr, o->scene->gamma );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Samples work unit u and accumulates the results per pixel in acc (tile_size x tile_size, zeroed).
+ *  Sample positions are generated on the fly.
+ *  Returns false when interrupted.
+ */
+static bl_t lum_machine_s_sample_unit( const lum_machine_s* o, tracer_s* tracer, const m3d_s* camera_rotation, const lum_unit_s* u, lum_s* acc )
+{
+    uz_t width = o->scene->image_width;
+    uz_t x0, y0, x1, y1;
+    lum_machine_s_tile_rect( o, u->k, &x0, &y0, &x1, &y1 );
+    y1 = y0 + u->row1;
+    y0 = y0 + u->row0;
+
+    for( uz_t j = y0; j < y1; j++ )
+    {
+        for( uz_t i = x0; i < x1; i++ )
+        {
+            uz_t pixel = j * width + i;
+            uz_t samples = o->pixel_samples[ pixel ];
+            if( samples == 0 ) continue;
+
+            lum_s* lum = &acc[ ( j - y0 ) * o->tile_size + ( i - x0 ) ];
+
+            // independent stream per pixel, so that positions do not depend on the processing order (SAMPLER_RANDOM)
+            uz_t image_pixel = ( j + o->origin_y ) * width + i;
+            u3_t rval = ( ( u3_t )sampler_hash_u2( o->rval, image_pixel ) << 32 ) | sampler_hash_u2( o->rval >> 32, image_pixel );
+
+            /** Sub-pixel positions continue the pixel's sequence:
+             *  The accumulated weight is the number of samples taken so far.
+             */
+            uz_t taken = o->lum_image->arr.data[ pixel ].weight;
+            sampler_s sampler;
+            sampler_s_init( &sampler, o->scene->sampler_type, i, j + o->origin_y, 0 );
+            sampler_set_s sample_set = sampler_s_open_at( &sampler, taken );
+
+            // tracer seeds depend only on image pixel and sample number, not on tiling or bands
+            u2_t pixel_seed = sampler_hash_u2( o->seed, image_pixel );
+
+            for( uz_t s = 0; s < samples; s++ )
+            {
+                if( signal_received_g == SIGINT ) return false;
+
+                v2d_s pos;
+                if( o->gradient_cycle == 0 )
+                {
+                    pos = ( v2d_s ){ i + 0.5, j + 0.5 };
+                }
+                else if( o->scene->sampler_type == SAMPLER_RANDOM )
+                {
+                    f3_t dx = f3_rnd1( &rval );
+                    f3_t dy = f3_rnd1( &rval );
+                    pos = ( v2d_s ){ i + dx, j + dy };
+                }
+                else
+                {
+                    pos = v2d_s_add( ( v2d_s ){ i, j }, sampler_set_s_get( &sample_set ) );
+                }
+
+                cl_s clr = lum_machine_s_trace_sample( o, tracer, camera_rotation, ( v2d_s ){ pos.x, pos.y + o->origin_y }, sampler_hash_u2( pixel_seed, taken + s ) );
+                lum->pos = v2d_s_add( lum->pos, pos );
+                lum->clr = v3d_s_add( lum->clr, clr );
+                lum->weight += 1.0;
+                lum->sqr += f3_sqr( lum_luminance( clr ) );
+            }
+        }
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// merges tile accumulator acc of work unit u into cycle_arr
+static void lum_machine_s_merge_unit( lum_machine_s* o, const lum_unit_s* u, const lum_s* acc )
+{
+    uz_t width = o->scene->image_width;
+    uz_t x0, y0, x1, y1;
+    lum_machine_s_tile_rect( o, u->k, &x0, &y0, &x1, &y1 );
+    for( uz_t j = y0 + u->row0; j < y0 + u->row1; j++ )
+    {
+        for( uz_t i = x0; i < x1; i++ )
+        {
+            const lum_s* lum = &acc[ ( j - y0 ) * o->tile_size + ( i - x0 ) ];
+            if( lum->weight > 0 ) o->cycle_arr[ j * width + i ] = *lum;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// pass 3: merges cycle_arr of claimed tiles into lum_image and clears it
+void lum_machine_s_commit_func( lum_machine_s* o, uz_t worker )
+{
+    uz_t width = o->scene->image_width;
+    uz_t k;
+    while( ( k = atomic_fetch_add_explicit( &o->next_tile, 1, memory_order_relaxed ) ) < o->tiles )
+    {
+        uz_t x0, y0, x1, y1;
+        lum_machine_s_tile_rect( o, k, &x0, &y0, &x1, &y1 );
+        for( uz_t j = y0; j < y1; j++ )
+        {
+            for( uz_t i = x0; i < x1; i++ )
+            {
+                lum_s* lum = &o->cycle_arr[ j * width + i ];
+                if( lum->weight > 0 )
+                {
+                    lum_s* dst = &o->lum_image->arr.data[ j * width + i ];
+                    *dst = lum_s_add( dst, lum );
+                    bcore_memzero( lum, sizeof( *lum ) );
+                }
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// pass 2: samples claimed work units and merges them into cycle_arr
+void lum_machine_s_trace_func( lum_machine_s* o, uz_t worker )
+{
+    m3d_s camera_rotation;
+    {
+        v3d_s ry = v3d_s_of_length( o->scene->camera_view_direction, 1 );
+        v3d_s rz = v3d_s_of_length( o->scene->camera_top_direction, 1 );
+        rz = v3d_s_von( ry, rz );
+        v3d_s rx = v3d_s_mlx( ry, rz );
+        camera_rotation.x = rx;
         camera_rotation.y = ry;
         camera_rotation.z = rz;
         camera_rotation = m3d_s_transposed( camera_rotation );
     }
 
+    tracer_s* tracer = &render_tracer_arr_g[ worker ];
+    tracer_s_begin( tracer, o->shared, compound_s_get_size( o->scene->light ) );
+
+    // tile-local accumulation buffer: memory is independent of the number of samples
+    uz_t acc_size = o->tile_size * o->tile_size;
+    lum_s* acc = bcore_alloc( NULL, sizeof( lum_s ) * acc_size );
+
     uz_t index;
-    while( ( index = lum_machine_s_get_index( o ) ) < o->lum_arr->size )
+    while( signal_received_g != SIGINT && !lum_machine_s_expired( o ) && tile_scheduler_s_claim( o->scheduler, worker, &index ) )
     {
-        if( signal_received_g == SIGINT ) break;
+        lum_unit_s* u = &o->unit_arr[ index ];
+        bcore_memzero( acc, sizeof( lum_s ) * acc_size );
 
-        lum_s* lum = &o->lum_arr->data[ index ];
-        f3_t monitor_y = lum->pos.y;
-        f3_t monitor_x = lum->pos.x;
-        f3_t z = unit_f * ( ( height >> 1 ) - monitor_y );
-        f3_t x = unit_f * ( monitor_x - ( width >> 1 ) );
-        v3d_s d = { x, o->scene->camera_focal_length, z };
-        d = v3d_s_of_length( d, 1.0 );
+        // only completed units are merged
+        f3_t time = wall_time();
+        if( lum_machine_s_sample_unit( o, tracer, &camera_rotation, u, acc ) )
+        {
+            lum_machine_s_merge_unit( o, u, acc );
+            u->time = f3_max( wall_time() - time, 1E-9 );
+        }
 
-        ray_s ray;
-        ray.p = o->scene->camera_position;
-        ray.d = m3d_s_mlv( &camera_rotation, d );
+        lum_machine_s_progress( o, u->samples );
+    }
 
-        cl_s out_clr = o->scene->background_color;
+    bcore_free( acc );
 
-        trans_data_s trans_l;
-        trans_data_s_init( &trans_l );
+    if( o->shared->path_guide ) tracer_s_flush_guide_records( tracer );
 
-        f3_t offs = scene_s_trans_hit( o->scene, &ray, &trans_l );
-        if( offs < f3_inf )
+    bcore_mutex_s_lock( &o->mutex );
+    tracer_stats_s_add( &o->shared->stats, &tracer->stats );
+    bcore_mutex_s_unlock( &o->mutex );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static int lum_unit_s_cmp( const void* a, const void* b )
+{
+    const lum_unit_s* ua = a;
+    const lum_unit_s* ub = b;
+    if( ua->cost != ub->cost ) return ua->cost < ub->cost ? 1 : -1;
+    if( ua->k    != ub->k    ) return ua->k    > ub->k    ? 1 : -1;
+    return ( ua->row0 > ub->row0 ) - ( ua->row0 < ub->row0 );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static lum_unit_s* lum_machine_s_push_unit( lum_machine_s* o )
+{
+    if( o->units == o->unit_space )
+    {
+        o->unit_space = o->unit_space > 0 ? o->unit_space * 2 : o->tiles + 16;
+        o->unit_arr = bcore_alloc( o->unit_arr, sizeof( lum_unit_s ) * o->unit_space );
+    }
+    lum_unit_s* u = &o->unit_arr[ o->units++ ];
+    bcore_memzero( u, sizeof( *u ) );
+    return u;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Builds the work units of the current cycle from tile_beg and pixel_samples and sorts them by decreasing predicted cost.
+ *  Predicted cost: samples times the time per sample of the tile in the previous cycle (mean value for unknown tiles).
+ *  Tiles exceeding the cost limit are split into bands of rows.
+ */
+static void lum_machine_s_plan_units( lum_machine_s* o, uz_t threads )
+{
+    uz_t width = o->scene->image_width;
+
+    f3_t known_cost = 0;
+    uz_t known = 0;
+    for( uz_t k = 0; k < o->tiles; k++ ) if( o->tile_cost[ k ] > 0 ) { known_cost += o->tile_cost[ k ]; known++; }
+    f3_t default_cost = ( known > 0 ) ? known_cost / known : 1.0;
+
+    f3_t total_cost = 0;
+    for( uz_t k = 0; k < o->tiles; k++ )
+    {
+        f3_t cost = o->tile_cost[ k ] > 0 ? o->tile_cost[ k ] : default_cost;
+        total_cost += ( o->tile_beg[ k + 1 ] - o->tile_beg[ k ] ) * cost;
+    }
+    f3_t limit = total_cost / ( LUM_UNITS_PER_THREAD * threads );
+
+    o->units = 0;
+    for( uz_t k = 0; k < o->tiles; k++ )
+    {
+        uz_t samples = o->tile_beg[ k + 1 ] - o->tile_beg[ k ];
+        if( samples == 0 ) continue;
+
+        uz_t x0, y0, x1, y1;
+        lum_machine_s_tile_rect( o, k, &x0, &y0, &x1, &y1 );
+        f3_t cost_per_sample = o->tile_cost[ k ] > 0 ? o->tile_cost[ k ] : default_cost;
+        f3_t cost = samples * cost_per_sample;
+        uz_t rows = y1 - y0;
+        uz_t bands = ( limit > 0 && cost > limit ) ? ceil( cost / limit ) : 1;
+        if( bands > rows ) bands = rows;
+        if( bands > 1 ) o->split_units += bands;
+
+        for( uz_t b = 0; b < bands; b++ )
         {
-            if( o->scene->experimental_level == 0 )
-            {
-                out_clr = scene_s_lum( o->scene, &ray, offs, &trans_l, o->scene->trace_depth, 1.0 );
-            }
-            else
+            lum_unit_s* u = lum_machine_s_push_unit( o );
+            u->k = k;
+            u->row0 = ( rows * b ) / bands;
+            u->row1 = ( rows * ( b + 1 ) ) / bands;
+            for( uz_t j = y0 + u->row0; j < y0 + u->row1; j++ )
             {
-                bcore_err_fa( "Unsupported experimental level #<s3_t>\n", o->scene->experimental_level );
+                for( uz_t i = x0; i < x1; i++ ) u->samples += o->pixel_samples[ j * width + i ];
             }
+            u->cost = u->samples * cost_per_sample;
         }
+    }
+
+    qsort( o->unit_arr, o->units, sizeof( lum_unit_s ), lum_unit_s_cmp );
+
+    // scheduler ranges balance the predicted cost
+    o->unit_beg = bcore_alloc( o->unit_beg, sizeof( uz_t ) * ( o->units + 1 ) );
+    f3_t scale = ( total_cost > 0 ) ? 1E9 / total_cost : 0;
+    o->unit_beg[ 0 ] = 0;
+    for( uz_t u = 0; u < o->units; u++ ) o->unit_beg[ u + 1 ] = o->unit_beg[ u ] + 1 + ( uz_t )( o->unit_arr[ u ].cost * scale );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
 
-        lum->clr = cl_s_sat( out_clr, o->scene->gamma );
+/// updates tile_cost from the times of completed units
+static void lum_machine_s_update_cost( lum_machine_s* o )
+{
+    // per tile: time, samples
+    f3_t* acc = bcore_alloc( NULL, sizeof( f3_t ) * 2 * ( o->tiles > 0 ? o->tiles : 1 ) );
+    bcore_memzero( acc, sizeof( f3_t ) * 2 * o->tiles );
+    for( uz_t u = 0; u < o->units; u++ )
+    {
+        const lum_unit_s* unit = &o->unit_arr[ u ];
+        if( unit->time == 0 ) continue;
+        o->busy_time += unit->time;
+        acc[ 2 * unit->k     ] += unit->time;
+        acc[ 2 * unit->k + 1 ] += unit->samples;
     }
-    return NULL;
+    for( uz_t k = 0; k < o->tiles; k++ )
+    {
+        if( acc[ 2 * k + 1 ] > 0 ) o->tile_cost[ k ] = acc[ 2 * k ] / acc[ 2 * k + 1 ];
+    }
+    bcore_free( acc );
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void lum_machine_s_run( const scene_s* scene, lum_arr_s* lum_arr )
+/** Renders a gradient cycle and merges the result into lum_image.
+ *  On SIGINT, lum_image is left unchanged and the samples of the cycle are discarded.
+ *  Returns the number of samples of the cycle.
+ */
+uz_t lum_machine_s_run_cycle( lum_machine_s* o, uz_t gradient_cycle, u2_t seed, u3_t rval )
 {
-    lum_machine_s* machine = lum_machine_s_plant( scene, lum_arr );
-    uz_t threads = scene->threads > 0 ? scene->threads : 1;
+    uz_t threads = o->threads;
+    render_pool_reserve( threads );
+    thread_pool_s_set_pinning( render_pool_g, o->scene->pin_threads > 0 );
+
+    o->gradient_cycle = gradient_cycle;
+    o->seed = seed;
+    o->rval = rval;
+
+    o->select_phase = 1;
+    if( o->scene->adaptive_error > 0 && gradient_cycle > 0 )
+    {
+        o->select_phase = 0;
+        atomic_store_explicit( &o->next_tile, 0, memory_order_relaxed );
+        thread_pool_s_run( render_pool_g, threads, ( thread_pool_job_fp )lum_machine_s_select_func, o );
+
+        f3_t error = 0;
+        uz_t open = 0;
+        for( uz_t k = 0; k < o->tiles; k++ )
+        {
+            error += o->tile_error[ k ];
+            open  += o->tile_open[ k ];
+        }
+        o->error_scale = ( error > 0 ) ? ( f3_t )( o->scene->gradient_samples * open ) / error : 0;
+        o->select_phase = 1;
+    }
+
+    atomic_store_explicit( &o->next_tile, 0, memory_order_relaxed );
+    thread_pool_s_run( render_pool_g, threads, ( thread_pool_job_fp )lum_machine_s_select_func, o );
+
+    o->tile_beg[ 0 ] = 0;
+    for( uz_t k = 0; k < o->tiles; k++ ) o->tile_beg[ k + 1 ] += o->tile_beg[ k ];
+
+    lum_machine_s_plan_units( o, threads );
+
+    tile_scheduler_s_discard( o->scheduler );
+    o->scheduler = tile_scheduler_s_create( o->unit_beg, o->units, threads );
+    atomic_store_explicit( &o->progress, 0, memory_order_relaxed );
+    f3_t time = wall_time();
+    thread_pool_s_run( render_pool_g, threads, ( thread_pool_job_fp )lum_machine_s_trace_func, o );
+    o->thread_time += ( wall_time() - time ) * threads;
+
+    if( signal_received_g == SIGINT )
+    {
+        bcore_memzero( o->cycle_arr, sizeof( lum_s ) * o->lum_image->width * o->lum_image->height );
+    }
+    else
+    {
+        atomic_store_explicit( &o->next_tile, 0, memory_order_relaxed );
+        thread_pool_s_run( render_pool_g, threads, ( thread_pool_job_fp )lum_machine_s_commit_func, o );
+    }
 
-    bcore_thread_s* thread_arr = bcore_u_alloc( sizeof( bcore_thread_s ), NULL, threads, NULL );
-    for( uz_t i = 0; i < threads; i++ ) thread_arr[ i ] = bcore_thread_call( ( vd_t(*)(vd_t) )lum_machine_s_func, machine );
-    for( uz_t i = 0; i < threads; i++ ) bcore_thread_join( thread_arr[ i ] );
+    lum_machine_s_update_cost( o );
 
-    bcore_free( thread_arr );
-    lum_machine_s_discard( machine );
+    return o->tile_beg[ o->tiles ];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-void scene_s_create_image_file( scene_s* o, sc_t file )
+/// creates the shared (scene-space) tracer data
+static void scene_s_shared_setup( const scene_s* o, tracer_shared_s* shared )
 {
-    BLM_INIT();
+    bcore_memzero( shared, sizeof( *shared ) );
+    if( o->irradiance_cache_accuracy > 0 && o->path_samples > 0 )
+    {
+        shared->irradiance_cache = irradiance_cache_s_create( o->irradiance_cache_accuracy, o->irradiance_cache_min_spacing, o->irradiance_cache_max_spacing );
+    }
+
+    if( o->caustic_photons > 0 && compound_s_get_size( o->light ) > 0 )
+    {
+        st_s_print_fa( "Tracing photons ...\n" );
+        shared->photon_map = photon_map_s_create();
+        scene_s_trace_photons( o, shared->photon_map );
+        photon_map_s_build( shared->photon_map );
+        bcore_msg_fa( "Caustic photons: #<uz_t>\n", photon_map_s_size( shared->photon_map ) );
+    }
+
+    if( o->occluder_grid_cells > 0 && compound_s_get_size( o->light ) > 0 )
+    {
+        shared->occluder_grid = occluder_grid_s_create( o->matter, o->light, o->occluder_grid_cells );
+        bcore_msg
+        (
+            "Occluder grid: %5.3g of %lu objects per cell and light\n",
+            occluder_grid_s_avg_candidates( shared->occluder_grid ),
+            ( unsigned long )occluder_grid_s_elements( shared->occluder_grid )
+        );
+    }
+
+    if( o->path_guide_fraction > 0 && o->path_samples > 0 )
+    {
+        shared->path_guide = path_guide_s_create();
+    }
+
+    if( o->visibility_cache_cell_size > 0 && compound_s_get_size( o->light ) > 0 )
+    {
+        shared->visibility_cache = visibility_cache_s_create( o->visibility_cache_cell_size, o->visibility_cache_tolerance );
+    }
+}
 
+//----------------------------------------------------------------------------------------------------------------------
+
+/// reports statistics and discards the shared tracer data
+static void scene_s_shared_report_down( const scene_s* o, tracer_shared_s* shared )
+{
+    if( o->direct_batch > 0 && shared->stats.direct_estimates > 0 )
+    {
+        bcore_msg
+        (
+            "Direct light: %lu estimates; %5.3g samples per estimate; %5.3g%% stopped after first batch\n",
+            ( unsigned long )shared->stats.direct_estimates,
+            ( f3_t )shared->stats.direct_samples / shared->stats.direct_estimates,
+            ( 100.0 * shared->stats.direct_early_exits ) / shared->stats.direct_estimates
+        );
+    }
+
+    if( shared->stats.occluder_tests > 0 )
+    {
+        bcore_msg
+        (
+            "Occluder cache: %5.3g%% hits of %lu tests\n",
+            ( 100.0 * shared->stats.occluder_hits ) / shared->stats.occluder_tests,
+            ( unsigned long )shared->stats.occluder_tests
+        );
+    }
+
+    if( shared->visibility_cache )
+    {
+        bcore_msg
+        (
+            "Visibility cache: %lu cells; %lu estimates reused cached visibility; %lu skipped as occluded\n",
+            ( unsigned long )visibility_cache_s_size( shared->visibility_cache ),
+            ( unsigned long )shared->stats.visibility_reuses,
+            ( unsigned long )shared->stats.visibility_skips
+        );
+        if( shared->stats.visibility_checks > 0 )
+        {
+            bcore_msg
+            (
+                "Visibility cache validation: %lu estimates; mean deviation %5.3g; max deviation %5.3g\n",
+                ( unsigned long )shared->stats.visibility_checks,
+                shared->stats.visibility_dev_sum / shared->stats.visibility_checks,
+                shared->stats.visibility_dev_max
+            );
+        }
+        visibility_cache_s_discard( shared->visibility_cache );
+    }
+
+    if( shared->path_guide )
+    {
+        bcore_msg_fa
+        (
+            "Path guide: #<uz_t> records; #<uz_t> regions\n",
+            path_guide_s_records( shared->path_guide ),
+            path_guide_s_regions( shared->path_guide )
+        );
+        path_guide_s_discard( shared->path_guide );
+    }
+
+    if( shared->irradiance_cache )
+    {
+        bcore_msg_fa( "Irradiance cache: #<uz_t> records\n", irradiance_cache_s_size( shared->irradiance_cache ) );
+        irradiance_cache_s_discard( shared->irradiance_cache );
+    }
+
+    photon_map_s_discard( shared->photon_map );
+    occluder_grid_s_discard( shared->occluder_grid );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void render_print_threads( const scene_s* o, uz_t threads )
+{
+    bcore_msg
+    (
+        "Threads: %lu (%s; %lu CPUs available; %lu NUMA nodes%s)\n",
+        ( unsigned long )threads,
+        o->threads > 0 ? "fixed" : "automatic",
+        ( unsigned long )thread_pool_cpu_list( NULL, 0 ),
+        ( unsigned long )thread_pool_numa_nodes(),
+        o->pin_threads > 0 ? "; pinned" : ""
+    );
+    if( thread_pool_cpu_quota() > 0 ) bcore_msg( "CPU quota: %lu\n", ( unsigned long )thread_pool_cpu_quota() );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void render_print_balance( f3_t busy_time, f3_t thread_time, uz_t split_units )
+{
+    if( thread_time <= 0 ) return;
+    bcore_msg
+    (
+        "Load balance: %5.3g%% thread utilization; %lu work units from split tiles\n",
+        ( 100.0 * busy_time ) / thread_time,
+        ( unsigned long )split_units
+    );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void scene_s_confirm_overwrite( sc_t file )
+{
     if( bcore_file_exists( file ) && !scene_s_overwrite_output_files_g )
     {
         bcore_msg_fa( "Image file '#<sc_t>' exists. Overwrite it? [Y|N]:", file );
@@ -1040,6 +2880,143 @@ void scene_s_create_image_file( scene_s* o, sc_t file )
         if( fgets( buf, sizeof( buf ), stdin )[ 0 ] != 'Y' ) bcore_exit( 1 );
 
     }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Striped mode: Bands of band_height rows are rendered one after another, each through all gradient cycles,
+ *  and streamed to the output file when finished.
+ *  Sample positions and seeds depend only on image pixel, sample number and cycle. A band is rendered with
+ *  a halo of gradient_cycles rows on either side, which covers the reach of the gradient selection over all cycles.
+ *  Thus the gradient rule selects the same samples as in a full image and bands are identical to the
+ *  corresponding rows of a full image, except:
+ *    - adaptive_error > 0: The sample budget is distributed per band rather than over the entire image.
+ *    - path guiding: The guide is trained on the bands rendered so far.
+ *  In these cases the result is statistically equivalent but not identical.
+ *  Resident image memory is bounded by ( band_height + 2 * gradient_cycles ) rows.
+ *  Crop window, progressive mode and recovery do not apply.
+ *  On SIGINT the remaining rows are filled with black.
+ */
+static void scene_s_create_image_file_striped( scene_s* o, sc_t file )
+{
+    scene_s_confirm_overwrite( file );
+    bcore_msg_fa( "Number of objects: #<uz_t>\n", scene_s_objects( o ) );
+    if( ( o->crop_width > 0 && o->crop_height > 0 ) || scene_s_crop_override_g )
+    {
+        bcore_msg( "Striped mode: crop window is ignored.\n" );
+    }
+    if( o->progressive_time > 0 || o->progressive_error > 0 )
+    {
+        bcore_msg( "Striped mode: progressive mode is ignored.\n" );
+    }
+
+    signal_received_g = 0;
+    signal( SIGINT, signal_callabck );
+
+    tracer_shared_s shared;
+    scene_s_shared_setup( o, &shared );
+    render_pool_reset();
+
+    uz_t width = o->image_width;
+    uz_t height = o->image_height;
+    uz_t band = o->band_height;
+    uz_t halo = o->gradient_cycles;
+
+    lum_image_s* lum_image = lum_image_s_create();
+    lum_image_s_reset( lum_image, width, band + 2 * halo );
+    u3_t start_rval = lum_image->rval;
+
+    image_pnm_stream_s stream;
+    image_pnm_stream_s_open( &stream, file, width, height );
+
+    render_print_threads( o, scene_s_render_threads( o ) );
+    bcore_msg( "Bands: %lu of %lu rows\n", ( unsigned long )( ( height + band - 1 ) / band ), ( unsigned long )band );
+
+    st_s_print_fa( "Rendering ...\n" );
+    clock_t time = clock();
+
+    f3_t busy_time = 0;
+    f3_t thread_time = 0;
+    uz_t split_units = 0;
+
+    for( uz_t y0 = 0; y0 < height && signal_received_g != SIGINT; y0 += band )
+    {
+        uz_t y1 = ( y0 + band < height ) ? y0 + band : height;
+        uz_t h0 = ( y0 > halo ) ? y0 - halo : 0;
+        uz_t h1 = ( y1 + halo < height ) ? y1 + halo : height;
+
+        lum_image_s_reset( lum_image, width, h1 - h0 );
+        pixel_rect_s rect = { 0, 0, width, h1 - h0 };
+        lum_machine_s* lum_machine = lum_machine_s_plant( o, &shared, lum_image, &rect );
+        lum_machine->origin_y = h0;
+
+        // same seed sequence as a full image
+        u3_t rval = start_rval;
+
+        st_s_print_fa( "\n\trows #<uz_t> ... #<uz_t>", y0, y1 - 1 );
+        for( uz_t gradient_cycle = 0; gradient_cycle <= o->gradient_cycles; gradient_cycle++ )
+        {
+            if( gradient_cycle == 0 )
+            {
+                st_s_print_fa( "\n\tmain image: " );
+            }
+            else
+            {
+                st_s_print_fa( "\n\tgradient pass #pl3 {#<uz_t>}: ", gradient_cycle );
+            }
+
+            uz_t samples = lum_machine_s_run_cycle( lum_machine, gradient_cycle, sampler_hash_u2( rval, gradient_cycle ), rval );
+            if( signal_received_g == SIGINT ) break;
+
+            if( shared.path_guide ) path_guide_s_train( shared.path_guide );
+            rval = bcore_lcg00_u3( rval );
+
+            if( gradient_cycle > 0 && samples == 0 ) break;
+        }
+
+        busy_time   += lum_machine->busy_time;
+        thread_time += lum_machine->thread_time;
+        split_units += lum_machine->split_units;
+        lum_machine_s_discard( lum_machine );
+
+        if( signal_received_g != SIGINT ) lum_image_s_stream_rows( lum_image, &stream, y0 - h0, y1 - h0 );
+    }
+
+    if( signal_received_g == SIGINT )
+    {
+        st_s_print_fa( "\nSIGINT received\nImage file #<sc_t>: rows #<uz_t> ... #<uz_t> filled with black.\n", file, stream.rows, height - 1 );
+        image_pnm_stream_s_pad( &stream );
+    }
+    else
+    {
+        st_s_print_fa( " hash: #<tp_t>", stream.hash );
+    }
+
+    image_pnm_stream_s_close( &stream );
+
+    time = clock() - time;
+    bcore_msg( "\n%5.3g cs\n", ( f3_t )time / ( CLOCKS_PER_SEC ) );
+    render_print_balance( busy_time, thread_time, split_units );
+
+    lum_image_s_discard( lum_image );
+    scene_s_shared_report_down( o, &shared );
+    signal( SIGINT, SIG_DFL );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void scene_s_create_image_file( scene_s* o, sc_t file )
+{
+    if( o->band_height > 0 && o->band_height < o->image_height )
+    {
+        scene_s_create_image_file_striped( o, file );
+        return;
+    }
+
+    BLM_INIT();
+    f3_t start_time = wall_time();
+
+    scene_s_confirm_overwrite( file );
 
     st_s* lum_image_tmp_file = BLM_CREATE( st_s );
     st_s_push_fa( lum_image_tmp_file, "#<sc_t>.tmp.lum_image", file );
@@ -1054,18 +3031,66 @@ void scene_s_create_image_file( scene_s* o, sc_t file )
 
     bcore_msg_fa( "Number of objects: #<uz_t>\n", scene_s_objects( o ) );
 
-    lum_arr_s* lum_arr = BLM_A_PUSH( lum_arr_s_create() );
+    /** Crop window:
+     *  A cropped image is rendered with a halo of gradient_cycles pixels (clipped to the image).
+     *  The gradient selection reaches one pixel further each cycle, so this halo lets pixels at the crop border
+     *  receive the same samples as in a full image (gradient rule; with adaptive_error the budget is distributed
+     *  over the rendered area). A patch needs no halo: Its neighbourhood is in the checkpoint.
+     */
+    pixel_rect_s crop = { 0, 0, o->image_width, o->image_height };
+    pixel_rect_s render_rect = crop;
+    bl_t cropped = false;
+    bl_t patch = false;
+    {
+        uz_t c[ 4 ] = { o->crop_x, o->crop_y, o->crop_width, o->crop_height };
+        if( scene_s_crop_override_g ) for( uz_t i = 0; i < 4; i++ ) c[ i ] = scene_s_crop_g[ i ];
+        if( c[ 2 ] > 0 && c[ 3 ] > 0 )
+        {
+            crop = pixel_rect_s_clip( ( pixel_rect_s ){ c[ 0 ], c[ 1 ], c[ 0 ] + c[ 2 ], c[ 1 ] + c[ 3 ] }, o->image_width, o->image_height );
+            if( pixel_rect_s_area( &crop ) == 0 ) bcore_err_fa( "Crop window is outside the image.\n" );
+            cropped = true;
+            patch = o->crop_patch > 0 || scene_s_crop_patch_g;
+            render_rect = crop;
+            if( !patch )
+            {
+                uz_t halo = o->gradient_cycles;
+                render_rect.x0 = crop.x0 > halo ? crop.x0 - halo : 0;
+                render_rect.y0 = crop.y0 > halo ? crop.y0 - halo : 0;
+                render_rect = pixel_rect_s_clip( ( pixel_rect_s ){ render_rect.x0, render_rect.y0, crop.x1 + halo, crop.y1 + halo }, o->image_width, o->image_height );
+            }
+            bcore_msg
+            (
+                "Crop window: %lu, %lu, %lu x %lu (%s)\n",
+                ( unsigned long )crop.x0, ( unsigned long )crop.y0,
+                ( unsigned long )( crop.x1 - crop.x0 ), ( unsigned long )( crop.y1 - crop.y0 ),
+                patch ? "patch" : "cropped image"
+            );
+        }
+    }
+    const pixel_rect_s* output_rect = ( cropped && !patch ) ? &crop : NULL;
 
     signal_received_g = 0;
     signal( SIGINT, signal_callabck );
 
-    uz_t rnd_samples = o->gradient_samples;
-    f3_t sqr_gradient_theshold = f3_sqr( o->gradient_threshold );
-
     lum_image_s* lum_image = BLM_A_PUSH( lum_image_s_create() );
     bl_t reset_lum_image = true;
 
-    if( bcore_file_exists( lum_image_tmp_file->sc ) )
+    if( patch )
+    {
+        if( !bcore_file_exists( lum_image_tmp_file->sc ) )
+        {
+            bcore_err_fa( "Patch: checkpoint '#<sc_t>' not found. (Render the full image with save_lum_image = 1.)\n", lum_image_tmp_file->sc );
+        }
+        bcore_bin_ml_a_from_file( lum_image, lum_image_tmp_file->sc );
+        if( lum_image->width != o->image_width || lum_image->height != o->image_height )
+        {
+            bcore_err_fa( "Patch: image size of checkpoint '#<sc_t>' differs.\n", lum_image_tmp_file->sc );
+        }
+        lum_image_s_clear_rect( lum_image, &crop );
+        lum_image->gradient_cycle = 0;
+        reset_lum_image = false;
+    }
+    else if( bcore_file_exists( lum_image_tmp_file->sc ) )
     {
         char buf[ 256 ];
         bl_t recover = true;
@@ -1096,69 +3121,128 @@ void scene_s_create_image_file( scene_s* o, sc_t file )
         lum_image_s_reset( lum_image, o->image_width, o->image_height );
     }
 
+    tracer_shared_s shared;
+    scene_s_shared_setup( o, &shared );
+
+    render_pool_reset();
+    lum_machine_s* lum_machine = lum_machine_s_plant( o, &shared, lum_image, &render_rect );
+
+    /** Progressive mode: gradient cycles continue until the time budget is used up or the error target is reached.
+     *  The time budget includes preprocessing (photon tracing, etc). Intermediate images are written in intervals.
+     */
+    bl_t progressive = o->progressive_time > 0 || o->progressive_error > 0;
+    if( o->progressive_time > 0 ) lum_machine->deadline = start_time + o->progressive_time;
+    f3_t output_time = 0;
+    f3_t error = f3_inf;
+    f3_t min_error = f3_inf;
+    uz_t stall_cycles = 0; // cycles without significant error reduction
+
+    /** The gradient rule keeps resampling edges and never revisits flat regions,
+     *  so the mean error may stay above the target.
+     */
+    if( o->progressive_error > 0 && o->adaptive_error == 0 )
+    {
+        bcore_msg( "Progressive mode: error target without adaptive_error; the error might not reach the target.\n" );
+    }
+
+    render_print_threads( o, lum_machine->threads );
+
     st_s_print_fa( "Rendering ...\n" );
     clock_t time = clock();
 
     u3_t rval = lum_image->rval;
-    for( uz_t gradient_cycle = lum_image->gradient_cycle; gradient_cycle <= o->gradient_cycles; gradient_cycle++ )
+    for( uz_t gradient_cycle = lum_image->gradient_cycle; progressive || gradient_cycle <= o->gradient_cycles; gradient_cycle++ )
     {
         lum_image->rval = rval;
         lum_image->gradient_cycle = gradient_cycle;
 
-        lum_arr_s_clear( lum_arr );
-
         if( gradient_cycle == 0 )
         {
             st_s_print_fa( "\n\tmain image: " );
-            for( uz_t j = 0; j < o->image_height; j++ )
-            {
-                for( uz_t i = 0; i < o->image_width; i++ )
-                {
-                    lum_arr_s_push_pos( lum_arr, ( v2d_s ){ i + 0.5, j + 0.5 } );
-                }
-            }
         }
         else
         {
             st_s_print_fa( "\n\tgradient pass #pl3 {#<uz_t>}: ", gradient_cycle );
-            for( s3_t j = 0; j < o->image_height; j++ )
-            {
-                for( s3_t i = 0; i < o->image_width; i++ )
-                {
-                    if( lum_image_s_sqr_grad( lum_image, i, j ) > sqr_gradient_theshold )
-                    {
-                        for( uz_t k = 0; k < rnd_samples; k++ )
-                        {
-                            f3_t dx = f3_rnd1( &rval );
-                            f3_t dy = f3_rnd1( &rval );
-                            lum_arr_s_push_pos( lum_arr, ( v2d_s ){ i + dx, j + dy } );
-                        }
-                    }
-                }
-            }
         }
 
-        lum_machine_s_run( o, lum_arr );
+        uz_t samples = lum_machine_s_run_cycle( lum_machine, gradient_cycle, sampler_hash_u2( rval, gradient_cycle ), rval );
 
         if( signal_received_g == SIGINT )
         {
             st_s_print_fa( "\n" );
             st_s_print_fa( "SIGINT received\n" );
-            if( gradient_cycle > 0 )
+            if( patch )
+            {
+                // the crop window is only partly re-rendered: the checkpoint is kept unchanged
+                st_s_print_fa( "Patch discarded; checkpoint #<sc_t> is unchanged\n", lum_image_tmp_file->sc );
+            }
+            else if( gradient_cycle > 0 )
             {
-                st_s_print_fa( "Saving result from last gradient cycle to file #<sc_t>\n", lum_image_tmp_file->sc );
+                st_s_print_fa( "Saving result of completed cycles to file #<sc_t>\n", lum_image_tmp_file->sc );
                 bcore_bin_ml_a_to_file( lum_image, lum_image_tmp_file->sc );
             }
             break;
         }
-        else
+
+        // no pixels selected: further cycles would not change the image
+        bl_t finished = gradient_cycle > 0 && samples == 0;
+
+        if( progressive )
+        {
+            error = lum_image_s_mean_relative_error( lum_image, &crop );
+            bcore_msg( " error %5.3g", error );
+            if( o->progressive_error > 0 && error <= o->progressive_error ) finished = true;
+            if( lum_machine->deadline > 0 && wall_time() >= lum_machine->deadline ) finished = true;
+            if( gradient_cycle >= o->progressive_cycles ) finished = true;
+
+            // warning when the error stops falling (less than 1% reduction over 8 cycles)
+            if( error < min_error * 0.99 )
+            {
+                min_error = error;
+                stall_cycles = 0;
+            }
+            else if( ++stall_cycles == 8 )
+            {
+                bcore_msg( "\nWarning: mean relative error stopped falling at %5.3g\n", min_error );
+            }
+        }
+
+        if( !progressive || finished || wall_time() - output_time >= o->progressive_interval )
         {
-            lum_image_s_push_arr( lum_image, lum_arr );
-            lum_image_s_create_image_file( lum_image, file );
+            lum_image_s_create_image_file( lum_image, output_rect, file );
+            output_time = wall_time();
         }
+
+        if( shared.path_guide ) path_guide_s_train( shared.path_guide );
+        rval = bcore_lcg00_u3( rval );
+
+        if( finished ) break;
     }
     time = clock() - time;
     bcore_msg( "\n%5.3g cs\n", ( f3_t )time / ( CLOCKS_PER_SEC ) );
+    render_print_balance( lum_machine->busy_time, lum_machine->thread_time, lum_machine->split_units );
+    lum_machine_s_discard( lum_machine );
+
+    if( progressive )
+    {
+        bcore_msg
+        (
+            "Progressive: %lu gradient cycles in %5.3g s; mean relative error %5.3g\n",
+            ( unsigned long )lum_image->gradient_cycle,
+            wall_time() - start_time,
+            error
+        );
+    }
+
+    if( signal_received_g != SIGINT && ( patch || o->save_lum_image > 0 ) )
+    {
+        st_s_print_fa( "Saving lum_image to file #<sc_t>\n", lum_image_tmp_file->sc );
+        bcore_bin_ml_a_to_file( lum_image, lum_image_tmp_file->sc );
+    }
+
+    lum_image_s_print_sample_stats( lum_image, &crop, o->adaptive_error );
+
+    scene_s_shared_report_down( o, &shared );
 
     signal( SIGINT, SIG_DFL );
     BLM_DOWN();
@@ -1184,6 +3268,12 @@ vd_t scene_signal_handler( const bcore_signal_s* o )
         }
         break;
 
+        case TYPEOF_down1:
+        {
+            render_pool_down();
+        }
+        break;
+
         default: break;
     }
     return NULL;
@@ -35,6 +35,11 @@ cl_s obj_color( vc_t o, v3d_s pos );
 extern bl_t scene_s_overwrite_output_files_g;
 extern bl_t scene_s_automatic_recover_g;
 
+/// command line override of the crop window: x, y, width, height (see scene_s crop_...)
+extern bl_t scene_s_crop_override_g;
+extern uz_t scene_s_crop_g[ 4 ];
+extern bl_t scene_s_crop_patch_g;
+
 typedef struct image_cps_s image_cps_s;
 BCORE_DECLARE_FUNCTIONS_OBJ( image_cps_s )
 
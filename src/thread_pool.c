@@ -0,0 +1,366 @@
+/** Thread Pool */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_getaffinity, pthread_setaffinity_np
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "bcore_threads.h"
+
+#include "thread_pool.h"
+
+/**********************************************************************************************************************/
+
+typedef struct tp_worker_s
+{
+    thread_pool_s* pool;
+    uz_t index;
+    uz_t generation; // last job seen
+    bl_t pinned;
+    bcore_thread_s thread;
+} tp_worker_s;
+
+/** Jobs are announced by incrementing generation under the mutex.
+ *  Workers not participating in a job just note its generation and go back to sleep.
+ */
+struct thread_pool_s
+{
+    bcore_mutex_s     mutex;
+    bcore_condition_s job_cond;  // new job or shutdown
+    bcore_condition_s done_cond; // all participating workers finished
+
+    tp_worker_s** worker_arr;
+    uz_t size;
+
+    thread_pool_job_fp job;
+    vd_t arg;
+    uz_t job_workers; // workers participating in current job
+    uz_t pending;     // participating workers not yet finished
+    uz_t generation;
+    bl_t shutdown;
+    bl_t pin;
+
+    uz_t* cpu_arr; // CPUs available to the process when the pool was created (see thread_pool_cpu_list)
+    uz_t  cpus;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/** Binds the calling thread to the index-th CPU of the pool (pin) or to all CPUs of the pool (!pin).
+ *  The CPU list is taken at pool creation, since the affinity of a pinned worker is a single CPU.
+ */
+static void tp_pin_self( const thread_pool_s* o, uz_t index, bl_t pin )
+{
+#ifdef __linux__
+    if( o->cpus == 0 ) return;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if( pin )
+    {
+        CPU_SET( o->cpu_arr[ index % o->cpus ], &set );
+    }
+    else
+    {
+        for( uz_t i = 0; i < o->cpus; i++ ) CPU_SET( o->cpu_arr[ i ], &set );
+    }
+    pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static vd_t tp_worker_func( vd_t arg )
+{
+    tp_worker_s* w = arg;
+    thread_pool_s* o = w->pool;
+
+    bcore_mutex_s_lock( &o->mutex );
+    for( ;; )
+    {
+        while( o->generation == w->generation && !o->shutdown ) bcore_condition_s_sleep( &o->job_cond, &o->mutex );
+        if( o->shutdown ) break;
+        w->generation = o->generation;
+        if( w->index >= o->job_workers ) continue;
+
+        thread_pool_job_fp job = o->job;
+        vd_t job_arg = o->arg;
+        bl_t pin = o->pin;
+        bcore_mutex_s_unlock( &o->mutex );
+
+        if( pin != w->pinned )
+        {
+            tp_pin_self( o, w->index, pin );
+            w->pinned = pin;
+        }
+
+        job( job_arg, w->index );
+
+        bcore_mutex_s_lock( &o->mutex );
+        if( --o->pending == 0 ) bcore_condition_s_wake_all( &o->done_cond );
+    }
+    bcore_mutex_s_unlock( &o->mutex );
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+thread_pool_s* thread_pool_s_create( void )
+{
+    thread_pool_s* o = bcore_alloc( NULL, sizeof( thread_pool_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+    bcore_mutex_s_init( &o->mutex );
+    bcore_condition_s_init( &o->job_cond );
+    bcore_condition_s_init( &o->done_cond );
+    o->cpus = thread_pool_cpu_list( NULL, 0 );
+    o->cpu_arr = bcore_alloc( NULL, sizeof( uz_t ) * ( o->cpus > 0 ? o->cpus : 1 ) );
+    uz_t cpus = thread_pool_cpu_list( o->cpu_arr, o->cpus );
+    if( cpus < o->cpus ) o->cpus = cpus;
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void thread_pool_s_discard( thread_pool_s* o )
+{
+    if( !o ) return;
+
+    bcore_mutex_s_lock( &o->mutex );
+    o->shutdown = true;
+    bcore_condition_s_wake_all( &o->job_cond );
+    bcore_mutex_s_unlock( &o->mutex );
+
+    for( uz_t i = 0; i < o->size; i++ )
+    {
+        bcore_thread_join( o->worker_arr[ i ]->thread );
+        bcore_free( o->worker_arr[ i ] );
+    }
+    if( o->worker_arr ) bcore_free( o->worker_arr );
+    bcore_free( o->cpu_arr );
+
+    bcore_condition_s_down( &o->done_cond );
+    bcore_condition_s_down( &o->job_cond );
+    bcore_mutex_s_down( &o->mutex );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void thread_pool_s_run( thread_pool_s* o, uz_t workers, thread_pool_job_fp job, vd_t arg )
+{
+    if( workers == 0 ) return;
+
+    // spawn missing workers (no job is running at this point)
+    if( workers > o->size )
+    {
+        o->worker_arr = bcore_alloc( o->worker_arr, sizeof( tp_worker_s* ) * workers );
+        for( uz_t i = o->size; i < workers; i++ )
+        {
+            tp_worker_s* w = bcore_alloc( NULL, sizeof( tp_worker_s ) );
+            w->pool = o;
+            w->index = i;
+            w->generation = o->generation;
+            w->pinned = false;
+            o->worker_arr[ i ] = w;
+            w->thread = bcore_thread_call( tp_worker_func, w );
+        }
+        o->size = workers;
+    }
+
+    bcore_mutex_s_lock( &o->mutex );
+    o->job = job;
+    o->arg = arg;
+    o->job_workers = workers;
+    o->pending = workers;
+    o->generation++;
+    bcore_condition_s_wake_all( &o->job_cond );
+    while( o->pending > 0 ) bcore_condition_s_sleep( &o->done_cond, &o->mutex );
+    bcore_mutex_s_unlock( &o->mutex );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t thread_pool_s_size( const thread_pool_s* o )
+{
+    return o->size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void thread_pool_s_set_pinning( thread_pool_s* o, bl_t pin )
+{
+    bcore_mutex_s_lock( &o->mutex );
+    o->pin = pin;
+    bcore_mutex_s_unlock( &o->mutex );
+}
+
+/**********************************************************************************************************************/
+
+/// parses a linux cpu list ( e.g. "0-3,8,10-11" ); calls fp( arg, cpu ) for each listed cpu
+static void tp_parse_cpu_list( FILE* file, void (*fp)( vd_t arg, uz_t cpu ), vd_t arg )
+{
+    unsigned long a, b;
+    for( ;; )
+    {
+        if( fscanf( file, "%lu", &a ) != 1 ) break;
+        b = a;
+        int c = fgetc( file );
+        if( c == '-' )
+        {
+            if( fscanf( file, "%lu", &b ) != 1 ) break;
+            c = fgetc( file );
+        }
+        for( unsigned long i = a; i <= b; i++ ) fp( arg, i );
+        if( c != ',' ) break;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+typedef struct tp_cpu_list_s
+{
+    cpu_set_t affinity;
+    cpu_set_t listed;
+    uz_t* cpu_arr;
+    uz_t space;
+    uz_t size;
+    uz_t node_size; // cpus added by current node
+} tp_cpu_list_s;
+
+static void tp_cpu_list_s_add( vd_t arg, uz_t cpu )
+{
+    tp_cpu_list_s* o = arg;
+    if( cpu >= CPU_SETSIZE || !CPU_ISSET( cpu, &o->affinity ) || CPU_ISSET( cpu, &o->listed ) ) return;
+    CPU_SET( cpu, &o->listed );
+    if( o->cpu_arr && o->size < o->space ) o->cpu_arr[ o->size ] = cpu;
+    o->size++;
+    o->node_size++;
+}
+
+/// lists available cpus node by node; returns number of nodes with available cpus
+static uz_t tp_cpu_list_s_fill( tp_cpu_list_s* o )
+{
+    CPU_ZERO( &o->listed );
+    o->size = 0;
+    if( sched_getaffinity( 0, sizeof( o->affinity ), &o->affinity ) != 0 ) return 0;
+
+    uz_t nodes = 0;
+    for( uz_t node = 0; node < 1024; node++ )
+    {
+        char path[ 64 ];
+        snprintf( path, sizeof( path ), "/sys/devices/system/node/node%lu/cpulist", ( unsigned long )node );
+        FILE* file = fopen( path, "r" );
+        if( !file )
+        {
+            if( node > 0 ) break; // nodes are numbered consecutively on most systems
+            continue;
+        }
+        o->node_size = 0;
+        tp_parse_cpu_list( file, tp_cpu_list_s_add, o );
+        fclose( file );
+        if( o->node_size > 0 ) nodes++;
+    }
+
+    // cpus not covered by node information
+    for( uz_t cpu = 0; cpu < CPU_SETSIZE; cpu++ ) tp_cpu_list_s_add( o, cpu );
+    return nodes > 0 ? nodes : 1;
+}
+
+#endif // __linux__
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t thread_pool_cpu_list( uz_t* cpu_arr, uz_t space )
+{
+#ifdef __linux__
+    tp_cpu_list_s list;
+    bcore_memzero( &list, sizeof( list ) );
+    list.cpu_arr = cpu_arr;
+    list.space = space;
+    if( tp_cpu_list_s_fill( &list ) > 0 && list.size > 0 ) return list.size;
+#endif
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    if( cpus < 1 ) cpus = 1;
+    for( uz_t i = 0; cpu_arr && i < space && i < ( uz_t )cpus; i++ ) cpu_arr[ i ] = i;
+    return cpus;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t thread_pool_numa_nodes( void )
+{
+#ifdef __linux__
+    tp_cpu_list_s list;
+    bcore_memzero( &list, sizeof( list ) );
+    uz_t nodes = tp_cpu_list_s_fill( &list );
+    return nodes > 0 ? nodes : 1;
+#else
+    return 1;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t thread_pool_cpu_quota( void )
+{
+    unsigned long quota = 0, period = 0;
+    char buf[ 64 ];
+
+    // cgroup v2: "<quota> <period>" or "max <period>"
+    FILE* file = fopen( "/sys/fs/cgroup/cpu.max", "r" );
+    if( file )
+    {
+        if( fscanf( file, "%63s %lu", buf, &period ) == 2 && buf[ 0 ] != 'm' ) quota = strtoul( buf, NULL, 10 );
+        fclose( file );
+    }
+    else
+    {
+        // cgroup v1: quota is -1 when unlimited
+        long v1_quota = -1;
+        file = fopen( "/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r" );
+        if( file ) { if( fscanf( file, "%ld", &v1_quota ) != 1 ) v1_quota = -1; fclose( file ); }
+        file = fopen( "/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r" );
+        if( file ) { if( fscanf( file, "%lu", &period ) != 1 ) period = 0; fclose( file ); }
+        if( v1_quota > 0 ) quota = v1_quota;
+    }
+
+    if( quota == 0 || period == 0 ) return 0;
+    return ( quota + period - 1 ) / period;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t thread_pool_auto_size( void )
+{
+    uz_t cpus = thread_pool_cpu_list( NULL, 0 );
+    uz_t quota = thread_pool_cpu_quota();
+    if( quota > 0 && quota < cpus ) cpus = quota;
+    return cpus > 0 ? cpus : 1;
+}
+
+/**********************************************************************************************************************/
+
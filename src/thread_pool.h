@@ -0,0 +1,70 @@
+/** Thread Pool */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "bcore_std.h"
+
+/**********************************************************************************************************************/
+
+/** Persistent worker threads.
+ *  Workers are spawned on demand and sleep between jobs until the pool is discarded.
+ *  A job is executed by a given number of workers; each receives its worker index, which is stable
+ *  over the lifetime of the pool (so per-worker state can be kept between jobs).
+ */
+typedef struct thread_pool_s thread_pool_s;
+
+/// job function; worker: index of executing worker
+typedef void (*thread_pool_job_fp)( vd_t arg, uz_t worker );
+
+thread_pool_s* thread_pool_s_create( void );
+void           thread_pool_s_discard( thread_pool_s* o ); // joins all workers
+
+/** Executes job( arg, worker ) on workers 0 ... workers - 1 and returns when all have finished.
+ *  Not reentrant: only one thread may run jobs on a pool.
+ */
+void thread_pool_s_run( thread_pool_s* o, uz_t workers, thread_pool_job_fp job, vd_t arg );
+
+/// number of spawned workers
+uz_t thread_pool_s_size( const thread_pool_s* o );
+
+/** Pinning: pin == true binds worker i to CPU i (modulo number of CPUs) of thread_pool_cpu_list.
+ *  Takes effect when a worker starts its next job. (Linux only; ignored elsewhere)
+ */
+void thread_pool_s_set_pinning( thread_pool_s* o, bl_t pin );
+
+/**********************************************************************************************************************/
+/// CPU topology
+
+/** CPUs available to the process (affinity mask) ordered by NUMA node; returns number of CPUs.
+ *  cpu_arr (may be NULL) receives up to space CPU indices.
+ */
+uz_t thread_pool_cpu_list( uz_t* cpu_arr, uz_t space );
+
+/// number of NUMA nodes having CPUs available to the process (1 when unknown)
+uz_t thread_pool_numa_nodes( void );
+
+/// CPU bandwidth limit of the process's cgroup in CPUs (rounded up); 0: no limit
+uz_t thread_pool_cpu_quota( void );
+
+/// recommended number of workers: available CPUs limited by the cgroup quota
+uz_t thread_pool_auto_size( void );
+
+/**********************************************************************************************************************/
+
+#endif // THREAD_POOL_H
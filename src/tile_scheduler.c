@@ -0,0 +1,161 @@
+/** Tile Scheduler */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "tile_scheduler.h"
+
+/**********************************************************************************************************************/
+
+/** A queue is a range [begin, end) of tile positions packed into a single atomic word ( begin | end << 32 ).
+ *  The owner claims by incrementing begin, thieves by decrementing end; both by compare-and-swap.
+ *  Queues are padded to occupy separate cache lines.
+ */
+typedef struct ts_queue_s
+{
+    _Atomic u3_t range;
+    u3_t pad[ 7 ];
+} ts_queue_s;
+
+struct tile_scheduler_s
+{
+    ts_queue_s* queue_arr;
+    uz_t  queues;
+    _Atomic uz_t steals;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline u3_t ts_range( u3_t begin, u3_t end )
+{
+    return begin | ( end << 32 );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// interleaves the lower 16 bits of x and y
+static inline u2_t ts_morton( u2_t x, u2_t y )
+{
+    u2_t v = 0;
+    for( uz_t i = 0; i < 16; i++ ) v |= ( ( ( x >> i ) & 1 ) << ( 2 * i ) ) | ( ( ( y >> i ) & 1 ) << ( 2 * i + 1 ) );
+    return v;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static int ts_cmp_u3( const void* a, const void* b )
+{
+    u3_t va = *( const u3_t* )a;
+    u3_t vb = *( const u3_t* )b;
+    return ( va > vb ) - ( va < vb );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void tile_morton_order( uz_t tiles_x, uz_t tiles_y, uz_t* order )
+{
+    uz_t tiles = tiles_x * tiles_y;
+    if( tiles == 0 ) return;
+
+    // key: morton << 32 | tile
+    u3_t* key = bcore_alloc( NULL, sizeof( u3_t ) * tiles );
+    for( uz_t t = 0; t < tiles; t++ ) key[ t ] = ( ( u3_t )ts_morton( t % tiles_x, t / tiles_x ) << 32 ) | t;
+    qsort( key, tiles, sizeof( u3_t ), ts_cmp_u3 );
+    for( uz_t k = 0; k < tiles; k++ ) order[ k ] = key[ k ] & 0xFFFFFFFFu;
+    bcore_free( key );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+tile_scheduler_s* tile_scheduler_s_create( const uz_t* tile_beg, uz_t tiles, uz_t queues )
+{
+    tile_scheduler_s* o = bcore_alloc( NULL, sizeof( tile_scheduler_s ) );
+    bcore_memzero( o, sizeof( *o ) );
+    if( queues == 0 ) queues = 1;
+
+    // contiguous ranges of tiles with similar number of items
+    uz_t first = tile_beg[ 0 ];
+    uz_t size  = tile_beg[ tiles ] - first;
+    o->queues = queues;
+    o->queue_arr = bcore_alloc( NULL, sizeof( ts_queue_s ) * queues );
+    bcore_memzero( o->queue_arr, sizeof( ts_queue_s ) * queues );
+    uz_t t = 0;
+    for( uz_t q = 0; q < queues; q++ )
+    {
+        uz_t begin = t;
+        if( size > 0 )
+        {
+            while( t < tiles && ( ( tile_beg[ t ] - first ) * queues ) / size <= q ) t++;
+        }
+        else
+        {
+            t = ( tiles * ( q + 1 ) ) / queues;
+        }
+        if( q == queues - 1 ) t = tiles;
+        atomic_init( &o->queue_arr[ q ].range, ts_range( begin, t ) );
+    }
+
+    atomic_init( &o->steals, 0 );
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void tile_scheduler_s_discard( tile_scheduler_s* o )
+{
+    if( !o ) return;
+    bcore_free( o->queue_arr );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bl_t tile_scheduler_s_claim( tile_scheduler_s* o, uz_t queue, uz_t* tile )
+{
+    for( uz_t k = 0; k < o->queues; k++ )
+    {
+        ts_queue_s* q = &o->queue_arr[ ( queue + k ) % o->queues ];
+        u3_t range = atomic_load_explicit( &q->range, memory_order_relaxed );
+        for( ;; )
+        {
+            u3_t begin = range & 0xFFFFFFFFu;
+            u3_t end   = range >> 32;
+            if( begin >= end ) break;
+
+            // owner takes the front; thieves take the back (far from the owner's working area)
+            u3_t next = ( k == 0 ) ? ts_range( begin + 1, end ) : ts_range( begin, end - 1 );
+            if( atomic_compare_exchange_weak_explicit( &q->range, &range, next, memory_order_relaxed, memory_order_relaxed ) )
+            {
+                if( k > 0 ) atomic_fetch_add_explicit( &o->steals, 1, memory_order_relaxed );
+                *tile = ( k == 0 ) ? begin : end - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t tile_scheduler_s_steals( const tile_scheduler_s* o )
+{
+    return atomic_load_explicit( &( ( tile_scheduler_s* )o )->steals, memory_order_relaxed );
+}
+
+/**********************************************************************************************************************/
+
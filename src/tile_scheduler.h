@@ -0,0 +1,56 @@
+/** Tile Scheduler */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include "bcore_std.h"
+
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** Distributes tiles of work items (image samples) among render threads.
+ *  Tiles are given as contiguous ranges of items in the order they should be processed
+ *  (e.g. Morton order, see tile_morton_order). The sequence is split into contiguous ranges
+ *  of similar item count, one range (queue) per thread.
+ *  A thread claims tiles from the front of its own queue; when its queue is exhausted it steals tiles
+ *  from the back of other queues. Claiming and stealing are lock-free.
+ */
+typedef struct tile_scheduler_s tile_scheduler_s;
+
+/** tile_beg[ t ]: first item of tile t; tile t comprises items tile_beg[ t ] ... tile_beg[ t + 1 ] - 1
+ *  Items need not be samples; any additive measure of work (e.g. predicted cost) can be used.
+ *  queues: number of queues (threads)
+ */
+tile_scheduler_s* tile_scheduler_s_create( const uz_t* tile_beg, uz_t tiles, uz_t queues );
+void              tile_scheduler_s_discard( tile_scheduler_s* o );
+
+/** Claims the next tile for queue (own queue first, then stealing).
+ *  Returns false when no tiles are left. (Thread safe)
+ */
+bl_t tile_scheduler_s_claim( tile_scheduler_s* o, uz_t queue, uz_t* tile );
+
+/// number of tiles claimed by stealing (Thread safe)
+uz_t tile_scheduler_s_steals( const tile_scheduler_s* o );
+
+/// order[ k ]: index ( ty * tiles_x + tx ) of the k-th tile of a tiles_x * tiles_y grid in Morton (z-) order
+void tile_morton_order( uz_t tiles_x, uz_t tiles_y, uz_t* order );
+
+/**********************************************************************************************************************/
+
+#endif // TILE_SCHEDULER_H
@@ -189,22 +189,109 @@ static inline u3_t v3d_s_random_seed( v3d_s o, u3_t rv )
            v3d_s_seed_from_f3( o.z ) * bcore_lcg02_u3( rv );
 }
 
-/** Random generators with even distribution over a spherical cap of height h.
- *  z component points to cap. Method is derived from Archimedes's sphere-cylinder theorem.
- *  Thanks to H Kong (http://www.bogotobogo.com/Algorithms/uniform_distribution_sphere.php)
- *  for pointing this out.
+/**********************************************************************************************************************/
+/** Counter-based random generator (crng).
+ *  Each value is a keyed hash of its counter value, hence values are mutually independent
+ *  and a block of CRNG_LANES values is computed in one lane-parallel loop (vectorizes to 4 (SSE) or
+ *  8 (AVX2) values per instruction). No state is carried between keys: the same key (e.g. pixel, sample, bounce)
+ *  always reproduces the same stream regardless of thread or evaluation order.
+ *  Mixing: two rounds of the lowbias32 integer hash (Wellons 2018) with key injection.
  */
-static inline v3d_s v3d_s_random_sphere_cap( u3_t* rv, f3_t h )
+#define CRNG_LANES 8
+
+typedef struct crng_s
+{
+    u2_t key0;
+    u2_t key1;
+    u2_t ctr;                // counter of next block
+    u2_t idx;                // index of next value in buf
+    u2_t buf[ CRNG_LANES ];
+} crng_s;
+
+static inline u2_t crng_mix_u2( u2_t x )
+{
+    x ^= x >> 16; x *= 0x7FEB352Du;
+    x ^= x >> 15; x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/// computes n values starting at counter ctr
+static inline void crng_block_u2( u2_t key0, u2_t key1, u2_t ctr, u2_t* dst, uz_t n )
+{
+    for( uz_t i = 0; i < n; i++ ) dst[ i ] = crng_mix_u2( crng_mix_u2( ( ctr + ( u2_t )i ) ^ key0 ) + key1 );
+}
+
+/// keys generator by three values (e.g. pixel, sample index, bounce)
+static inline void crng_s_init( crng_s* o, u2_t k0, u2_t k1, u2_t k2 )
+{
+    o->key0 = crng_mix_u2( k0 ^ crng_mix_u2( k1 + 0x9E3779B9u ) );
+    o->key1 = crng_mix_u2( o->key0 ^ ( k2 + 0x85EBCA6Bu ) );
+    o->ctr  = 0;
+    o->idx  = CRNG_LANES;
+}
+
+static inline u2_t crng_s_u2( crng_s* o )
+{
+    if( o->idx == CRNG_LANES )
+    {
+        crng_block_u2( o->key0, o->key1, o->ctr, o->buf, CRNG_LANES );
+        o->ctr += CRNG_LANES;
+        o->idx = 0;
+    }
+    return o->buf[ o->idx++ ];
+}
+
+/// random value in [0,1)
+static inline f3_t crng_s_f3( crng_s* o )
+{
+    return crng_s_u2( o ) * ( 1.0 / 4294967296.0 );
+}
+
+/**********************************************************************************************************************/
+
+/** Maps a point uv of the unit square onto a spherical cap of height h preserving even distribution.
+ *  z component points to cap.
+ */
+static inline v3d_s v3d_s_sphere_cap_of_uv( v2d_s uv, f3_t h )
 {
     v3d_s v;
-    f3_t phi = 2.0 * M_PI * f3_rnd1( rv );
-    v.z = 1.0 - f3_rnd1( rv ) * h;
+    f3_t phi = 2.0 * M_PI * uv.x;
+    v.z = 1.0 - uv.y * h;
     f3_t scale = sqrt( 1.0 - v.z * v.z );
     v.x = sin( phi ) * scale;
     v.y = cos( phi ) * scale;
     return v;
 }
 
+/** Maps a point uv of the unit square onto the unit half-sphere with cosine-weighted distribution.
+ *  z component points to the pole. Probability density: z / PI.
+ *  Method: Uniform distribution on the unit disk projected onto the half-sphere (Malley's method).
+ */
+static inline v3d_s v3d_s_hemisphere_cos_of_uv( v2d_s uv )
+{
+    v3d_s v;
+    f3_t phi = 2.0 * M_PI * uv.x;
+    f3_t scale = sqrt( uv.y );
+    v.x = sin( phi ) * scale;
+    v.y = cos( phi ) * scale;
+    v.z = sqrt( 1.0 - uv.y );
+    return v;
+}
+
+/** Random generator (counter-based) with even distribution over a spherical cap of height h.
+ *  z component points to cap. Method is derived from Archimedes's sphere-cylinder theorem.
+ *  Thanks to H Kong (http://www.bogotobogo.com/Algorithms/uniform_distribution_sphere.php)
+ *  for pointing this out.
+ */
+static inline v3d_s v3d_s_crng_sphere_cap( crng_s* rng, f3_t h )
+{
+    v2d_s uv;
+    uv.x = crng_s_f3( rng );
+    uv.y = crng_s_f3( rng );
+    return v3d_s_sphere_cap_of_uv( uv, h );
+}
+
 /// symmetric belt around unit-sphere (h indicates half-height of belt; h = 1: entire sphere)
 static inline v3d_s v3d_s_random_sphere_belt( u3_t* rv, f3_t h )
 {
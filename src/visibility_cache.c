@@ -0,0 +1,145 @@
+/** Visibility Cache */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <math.h>
+#include <stdatomic.h>
+
+#include "visibility_cache.h"
+
+/**********************************************************************************************************************/
+
+/// hash table with open addressing (linear probing over at most VC_PROBES slots)
+#define VC_TABLE_BITS 20
+#define VC_TABLE_SIZE ( 1 << VC_TABLE_BITS )
+#define VC_PROBES     8
+
+typedef struct vc_slot_s
+{
+    _Atomic u3_t key;   // 0: empty
+    _Atomic u3_t count; // visible shadow rays (high 32 bits), shadow rays (low 32 bits)
+} vc_slot_s;
+
+struct visibility_cache_s
+{
+    f3_t cell_size;
+    f3_t tolerance;
+    vc_slot_s* table;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+visibility_cache_s* visibility_cache_s_create( f3_t cell_size, f3_t tolerance )
+{
+    visibility_cache_s* o = bcore_alloc( NULL, sizeof( visibility_cache_s ) );
+    o->cell_size = cell_size;
+    o->tolerance = tolerance;
+    o->table = bcore_alloc( NULL, sizeof( vc_slot_s ) * VC_TABLE_SIZE );
+    for( uz_t i = 0; i < VC_TABLE_SIZE; i++ )
+    {
+        atomic_init( &o->table[ i ].key, 0 );
+        atomic_init( &o->table[ i ].count, 0 );
+    }
+    return o;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void visibility_cache_s_discard( visibility_cache_s* o )
+{
+    if( !o ) return;
+    bcore_free( o->table );
+    bcore_free( o );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// dominant axis and sign of nor (0 ... 5)
+static inline u2_t vc_direction( v3d_s nor )
+{
+    f3_t ax = f3_abs( nor.x );
+    f3_t ay = f3_abs( nor.y );
+    f3_t az = f3_abs( nor.z );
+    if( ax >= ay && ax >= az ) return nor.x >= 0 ? 0 : 1;
+    if( ay >= az )             return nor.y >= 0 ? 2 : 3;
+    return nor.z >= 0 ? 4 : 5;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t visibility_cache_s_slot( visibility_cache_s* o, v3d_s pos, v3d_s nor, uz_t light_index )
+{
+    u2_t x = ( s3_t )floor( pos.x / o->cell_size );
+    u2_t y = ( s3_t )floor( pos.y / o->cell_size );
+    u2_t z = ( s3_t )floor( pos.z / o->cell_size );
+    u2_t d = vc_direction( nor ) + 6 * ( u2_t )light_index;
+
+    u2_t h0 = crng_mix_u2( x ^ crng_mix_u2( y ^ crng_mix_u2( z ^ crng_mix_u2( d ) ) ) );
+    u2_t h1 = crng_mix_u2( h0 ^ 0x5BD1E995 );
+    u3_t key = ( ( u3_t )h1 << 32 ) | h0;
+    key = key ? key : 1;
+
+    for( uz_t i = 0; i < VC_PROBES; i++ )
+    {
+        uz_t slot = ( h0 + i ) & ( VC_TABLE_SIZE - 1 );
+        u3_t expected = atomic_load_explicit( &o->table[ slot ].key, memory_order_relaxed );
+        if( expected == key ) return slot;
+        if( expected == 0 )
+        {
+            if( atomic_compare_exchange_strong( &o->table[ slot ].key, &expected, key ) ) return slot;
+            if( expected == key ) return slot; // claimed concurrently for the same cell
+        }
+    }
+    return VISIBILITY_CACHE_NONE;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bl_t visibility_cache_s_get( const visibility_cache_s* o, uz_t slot, f3_t* visibility )
+{
+    if( slot == VISIBILITY_CACHE_NONE ) return false;
+    u3_t count = atomic_load_explicit( &o->table[ slot ].count, memory_order_relaxed );
+    f3_t visible = count >> 32;
+    f3_t samples = count & 0xFFFFFFFFu;
+    if( samples == 0 ) return false;
+
+    // standard error of the estimate; laplace smoothing avoids premature certainty for unanimous samples
+    f3_t p = ( visible + 1.0 ) / ( samples + 2.0 );
+    if( sqrt( p * ( 1.0 - p ) / samples ) > o->tolerance ) return false;
+
+    *visibility = visible / samples;
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void visibility_cache_s_add( visibility_cache_s* o, uz_t slot, uz_t visible, uz_t samples )
+{
+    if( slot == VISIBILITY_CACHE_NONE || samples == 0 ) return;
+    atomic_fetch_add_explicit( &o->table[ slot ].count, ( ( u3_t )visible << 32 ) + samples, memory_order_relaxed );
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uz_t visibility_cache_s_size( const visibility_cache_s* o )
+{
+    uz_t size = 0;
+    for( uz_t i = 0; i < VC_TABLE_SIZE; i++ ) size += ( atomic_load_explicit( &o->table[ i ].key, memory_order_relaxed ) != 0 );
+    return size;
+}
+
+/**********************************************************************************************************************/
+
@@ -0,0 +1,62 @@
+/** Visibility Cache */
+
+/** Copyright 2017 Johannes Bernhard Steffens
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef VISIBILITY_CACHE_H
+#define VISIBILITY_CACHE_H
+
+#include "bcore_std.h"
+
+#include "vectors.h"
+#include "quicktypes.h"
+
+/**********************************************************************************************************************/
+
+/** Spatial cache of the fractional visibility of light sources.
+ *  Surface positions are grouped into cubic cells of given size. A cell is further distinguished
+ *  by the dominant axis of the surface normal (so both sides of a thin wall use different cells).
+ *  Per cell and light source the cache accumulates the number of shadow rays and visible shadow rays.
+ *  The visibility of a cell is regarded as known when the standard error of its estimate is within tolerance.
+ *
+ *  The cache is a fixed size hash table shared among render threads; all operations are lock-free.
+ */
+typedef struct visibility_cache_s visibility_cache_s;
+
+/// invalid slot (table crowded)
+#define VISIBILITY_CACHE_NONE ( ( uz_t )-1 )
+
+/** cell_size: edge length of a cell
+ *  tolerance: maximum standard error of a known visibility
+ */
+visibility_cache_s* visibility_cache_s_create( f3_t cell_size, f3_t tolerance );
+void                visibility_cache_s_discard( visibility_cache_s* o );
+
+/// slot of the cell of pos, nor for light source light_index; creates the slot if necessary
+uz_t visibility_cache_s_slot( visibility_cache_s* o, v3d_s pos, v3d_s nor, uz_t light_index );
+
+/// returns true when the visibility in slot is known; *visibility receives the visible fraction
+bl_t visibility_cache_s_get( const visibility_cache_s* o, uz_t slot, f3_t* visibility );
+
+/// adds shadow rays to the estimate in slot
+void visibility_cache_s_add( visibility_cache_s* o, uz_t slot, uz_t visible, uz_t samples );
+
+/// number of occupied slots
+uz_t visibility_cache_s_size( const visibility_cache_s* o );
+
+/**********************************************************************************************************************/
+
+#endif // VISIBILITY_CACHE_H